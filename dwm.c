@@ -4,24 +4,49 @@
 #include <X11/Xresource.h>
 #include <X11/Xutil.h>
 #include <X11/extensions/Xinerama.h>
+#include <X11/extensions/Xrandr.h>
+#include <X11/extensions/sync.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "shared.h"
+
 #define WORKSPACES 4
+#define MAXKILLS 32
+#define MAXCLIENTS 4096
+#define DAMPREPEATS 4 // identical ConfigureRequests answered before damping
+#define CMDQUEUE 256 // power of two
+#define MAXSPAWNS 16
+#define SPAWNTIMEOUT 30 // seconds a spawned program has to map its windows
+#define MAXMONS 16
+#define EVQUEUE 512 // per class, power of two
+#define BUCKETS 128 // of Latency, four per power of two up to about an hour
 #define MAX(A, B) ((A) > (B) ? (A) : (B))
 #define MIN(A, B) ((A) < (B) ? (A) : (B))
-#define INTERSECT(x,y,w,h,m) (MAX(0, MIN((x)+(w),(m)->wx+(m)->ww) - MAX((x),(m)->wx)) * MAX(0, MIN((y)+(h),(m)->wy+(m)->wh) - MAX((y),(m)->wy)))
 #define WORKSPACE(M) (M->workspaces[M->workspace])
 #define ISVISIBLE(C) (C->workspace == &WORKSPACE(C->mon))
+#define ISVISIBLEON(C, M) (C->workspace == &WORKSPACE(M))
+#define INPOOL(C) ((C) >= clientpool && (C) < clientpool + MAXCLIENTS)
+#define HINTS(C) (INPOOL(C) ? &hintpool[(C) - clientpool] : &((Spilled *)(C))->hints)
 #define LENGTH(X) (sizeof X / sizeof X[0])
 #define WIDTH(X) ((X)->w + 2 * borderpx)
 #define HEIGHT(X) ((X)->h + 2 * borderpx)
@@ -30,6 +55,11 @@
 #define FOREACH(X, XS) for (X = XS; X; X = X->next)
 #define FIND(X, COND) while(X) { if (COND) break; else X = X->next; }
 #define dwmfifo "/tmp/dwm.fifo"
+#define dwmstate "/tmp/dwm.state"
+#define dwmstats "/tmp/dwm.stats"
+#define dwmnoise "/tmp/dwm.noise"
+#define NOISIEST 10 // clients listed by dumpnoise()
+#define dwmshared SHAREDNAME // the page publish() keeps current, laid out in shared.h
 
 void die(const char *msg) {
 	fputs(msg, stderr);
@@ -56,6 +86,11 @@ enum EMWHAtom {
 	NetWMWindowType,
 	NetWMWindowTypeDialog,
 	NetClientList,
+	NetWMPing,
+	NetWMPid,
+	NetWMBypassCompositor,
+	NetWMSyncRequest,
+	NetWMSyncRequestCounter,
 	NetLast
 };
 
@@ -64,44 +99,182 @@ enum DefaultAtom {
 	WMDelete,
 	WMState,
 	WMTakeFocus,
+	WMWindowRole,
 	WMLast
 };
 
+enum Protocol { // bits of Client.protocols
+	ProtoDelete = 1 << 0,
+	ProtoTakeFocus = 1 << 1,
+	ProtoPing = 1 << 2,
+	ProtoSync = 1 << 3
+};
+
+// X events in the order run() handles them, see evclass()
+enum Class {
+	ClassInput,
+	ClassStructure,
+	ClassProperty,
+	ClassLast
+};
+
+// events charged to the client they are about, see runevents()
+enum Noise {
+	NoiseProperty,
+	NoiseConfigure,
+	NoiseMessage,
+	NoiseEnter,
+	NoiseFocus,
+	NoiseLast
+};
+
+enum Dir {
+	DirLeft,
+	DirRight,
+	DirUp,
+	DirDown,
+	DirLast
+};
+
+enum Timer {
+	TimerGeom,
+	TimerKill,
+	TimerHover,
+	TimerLast
+};
+
 typedef struct Monitor Monitor;
 typedef struct Client Client;
 typedef struct Workspace Workspace;
+typedef struct Hints Hints;
 
 typedef void (*Layout)(Monitor *m);
 
 struct Workspace {
 	float mfact;
 	Layout layout;
+	Client *stack; // focus order, the head is the selected client
 };
 
+// what the layouts and visibility scans touch; the rest lives in Hints
 struct Client {
-	float mina, maxa;
-	int x, y, w, h;
-	int oldx, oldy, oldw, oldh;
-	int basew, baseh, incw, inch, maxw, maxh, minw, minh;
+	Client *next, *prev; // client order, all monitors
+	Client *snext, *sprev; // focus order within the workspace
 	Workspace *workspace;
-	Client *next;
-	Client *snext;
 	Monitor *mon;
+	int x, y, w, h;
 	Window win;
-	bool isfixed, isfloating, neverfocus, oldstate, isfullscreen;
+	bool isfloating, isfullscreen;
+	bool staleborder; // border colour changed while hidden
+	bool needsgeom; // hidden under monocle, resized when it comes on top
+	bool isurgent;
+	bool hidden; // off screen, moved there by showhide() or manage()
+	bool syncing; // asked to draw at its new size, see waitsync()
+	unsigned char protocols; // WM_PROTOCOLS the client supports
 };
+// layouts walk every client, keep what they don't read in Hints
+_Static_assert(sizeof(Client) <= 80, "Client grew past 80 bytes");
+
+// rarely used client data, indexed like clientpool or right after a Spilled client
+struct Hints {
+	float mina, maxa;
+	int basew, baseh, incw, inch, maxw, maxh, minw, minh;
+	bool valid; // WM_NORMAL_HINTS haven't changed since they were read
+	bool isfixed, neverfocus, oldstate;
+	bool destroyed; // window is gone, set by unmanage()
+	bool bypass; // _NET_WM_BYPASS_COMPOSITOR was set by dwm, not the client
+	int oldx, oldy, oldw, oldh; // geometry before the last resize
+	// last ConfigureRequest, to catch clients repeating it endlessly
+	unsigned long reqmask;
+	int reqx, reqy, reqw, reqh;
+	long long reqtime;
+	unsigned char repeats;
+	unsigned int damped; // requests ignored
+	long long mapped; // MapRequest time, until the first flush() after it
+	XSyncCounter counter; // _NET_WM_SYNC_REQUEST_COUNTER, None without ProtoSync
+	long long syncvalue; // what counter is set to once the client has drawn
+	XSyncAlarm alarm; // fires when counter reaches syncvalue, None until needed
+	Client *unext, *uprev; // urgency order, see seturgent()
+	unsigned int noise[NoiseLast]; // events handled for the client
+	long long noisetime[NoiseLast]; // and the microseconds they took
+};
+
+// a client that found clientpool full, allocated together with its hints
+typedef struct {
+	Client client;
+	Hints hints;
+} Spilled;
 
 struct Monitor {
 	int mx, my, mw, mh; // screen size
 	int wx, wy, ww, wh; // window area
-	Client *clients;
 	Client *sel;
-	Client *stack;
 	Monitor *next;
 	Workspace workspaces[WORKSPACES];
 	unsigned char workspace;
+	bool dirty; // needs arrange once the current event batch is handled
+	Client *fullscreen; // covers the selected workspace, layout and restack wait
+	Monitor *adj[DirLast]; // nearest monitor in each direction, see updateindex()
 };
 
+// a client asked to close that gets killed if it is still around at the
+// deadline and didn't answer a ping; win is None once either happened
+typedef struct {
+	Window win;
+	long long deadline;
+} PendingKill;
+
+// a FIFO command decoded by readcmds(), waiting for the main loop
+typedef struct {
+	unsigned char op;
+	long long queued; // when it was read, see now()
+	char arg[256]; // rest of the line, for commands that take one
+} Command;
+
+// an X event taken off the Xlib queue, waiting for its turn in run()
+typedef struct {
+	XEvent ev;
+	long long queued; // when it was taken, see now()
+} QueuedEvent;
+
+// how long something took, in microseconds
+typedef struct {
+	unsigned int n;
+	long long total, max;
+	unsigned int buckets[BUCKETS]; // see bucket()
+} Latency;
+
+// what evpredicate() learns while Xlib walks its queue for it
+typedef struct {
+	enum Class class; // where the accepted event goes
+	Window skipped[16]; // windows with structure events left behind
+	unsigned char nskipped; // more than fit means nothing may jump ahead
+} Intake;
+
+// where the windows of a program started by spawn() go
+typedef struct {
+	pid_t pid;
+	Monitor *mon;
+	unsigned char workspace;
+	long long time;
+} Spawn;
+
+// placement for windows matching class, instance and role, "*" matches any
+typedef struct {
+	char *class, *instance, *role; // NULL marks a free slot in rules
+	signed char workspace, monitor, floating; // -1 leaves it to manage()
+} Rule;
+
+_Static_assert(MAXMONS == SHAREDMONS && WORKSPACES == SHAREDWORKSPACES, "shared.h is out of step");
+
+// a client as written by savestate() before a restart
+typedef struct {
+	Window win;
+	unsigned int mon, workspace;
+	int isfloating, oldstate;
+	int oldx, oldy, oldw, oldh;
+} SavedClient;
+
 enum ResourceType {
 	INTEGER,
 	FLOAT,
@@ -110,42 +283,86 @@ enum ResourceType {
 
 // function declarations
 static int applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact);
+static Client *allocclient(void);
 static void arrange(Monitor *m);
 static void arrangemon(Monitor *m);
 static void attach(Client *c);
 static void attachstack(Client *c);
+static unsigned int bucket(long long us);
 static void checkotherwm(void);
 static void cleanup(void);
 static void cleanupmon(Monitor *mon);
+static void compilerules(XrmDatabase db);
 static void clientmessage(XEvent *e);
 static void configure(Client *c);
 static void configurenotify(XEvent *e);
 static void configurerequest(XEvent *e);
+static FILE *createfile(const char *path);
 static Monitor *createmon(void);
+static bool damp(Client *c, XConfigureRequestEvent *ev);
 static void cyclelayout(char x);
 static void destroynotify(XEvent *e);
 static void detach(Client *c);
 static void detachstack(Client *c);
 static Monitor *dirtomon(int dir);
-static void dispatchcmd(void);
+static void dispatchcmd(Command *cmd);
+static void dropevents(int type);
+static void dumpnoise(void);
+static void dumpstats(void);
 static void enternotify(XEvent *e);
+static enum Class evclass(XEvent *ev);
+static Bool evpredicate(Display *dpy, XEvent *ev, XPointer arg);
+static Window evwindow(XEvent *ev);
+static void flush(void);
 static void focus(Client *c);
+static Client *fullscreenon(Monitor *m);
+static void focusdir(enum Dir dir);
 static void focusin(XEvent *e);
+static void focusurgent(void);
 static void focusmon(char x);
+static void focusprev(void);
 static void focusstack(char x);
+static void freeclient(Client *c);
+static void geomtimeout(void);
 static int getrootptr(int *x, int *y);
 static long getstate(Window w);
+static int gettextprop(Window w, Atom atom, char *text, unsigned int size);
+static pid_t getwinpid(Window w);
+static void hover(Window w);
+static void hovertimeout(void);
+static void jumpto(Client *c);
 static void killclient(void);
+static void loadstate(void);
 static void manage(Window w, XWindowAttributes *wa);
 static void maprequest(XEvent *e);
-static Client *nexttiled(Client *c);
+static Client *nexttiled(Client *c, Monitor *m);
+static struct timeval *nexttimer(struct timeval *tv);
+static long long now(void);
+static void pingtimeout(void);
 static void pop(Client *);
 static void propertynotify(XEvent *e);
-static Monitor *recttomon(int x, int y, int w, int h);
+static long long percentile(Latency *l, unsigned int pct);
+static void printlatency(FILE *f, Latency *l);
+static Monitor *pointtomon(int x, int y);
+static void publish(void);
+static void record(Latency *l, long long us);
+static void pushcmd(Command *cmd);
+static void *readcmds(void *unused);
+static unsigned char protomask(Atom proto);
+static void reload(void);
 static void resize(Client *c, int x, int y, int w, int h, int interact);
 static void resizeclient(Client *c, int x, int y, int w, int h);
 static void restack(Monitor *m);
+static void restart(void);
+static void reveal(Monitor *m);
+static Rule *rulefor(Window w);
+static unsigned int rulehash(const char *class, const char *instance, const char *role);
+static void rrnotify(XEvent *e);
 static void run(void);
+static void runcmds(void);
+static void runevents(enum Class k);
+static void runtimers(void);
+static bool savestate(void);
 static void scan(void);
 static int sendevent(Client *c, Atom proto);
 static void sendmon(Client *c, Monitor *m);
@@ -154,10 +371,17 @@ static void setfocus(Client *c);
 static void setfullscreen(Client *c, int fullscreen);
 static void setlayout(Layout layout);
 static void setmfact(float x);
+static void syncrequest(Client *c);
+static void seturgent(Client *c, bool urgent);
+static void settimer(enum Timer t, unsigned int ms);
 static void setup(void);
 static void showhide(Client *c);
 static void sigchld(int unused);
+static void spawn(char *cmd);
+static Spawn *spawnfor(Window w);
+static void sighup(int unused);
 static void tag(unsigned char x);
+static void tagdir(enum Dir dir);
 static void tagmon(char x);
 static void togglefloating(void);
 static void unfocus(Client *c, int setfocus);
@@ -165,6 +389,9 @@ static void unmanage(Client *c, int destroyed);
 static void unmapnotify(XEvent *e);
 static void updateclientlist(void);
 static int updategeom(void);
+static void updateindex(void);
+static void waitsync(void);
+static void updateprotocols(Client *c);
 static void updatesizehints(Client *c);
 static void updatewindowtype(Client *c);
 static void updatewmhints(Client *c);
@@ -180,11 +407,11 @@ static void resource_load(XrmDatabase db, char *name, enum ResourceType rtype, v
 static float clamp(float x, float l, float h);
 static unsigned int tile_count(Monitor *m);
 static void monocle(Monitor *m);
+static enum Noise noiseof(int type);
 static void tile(Monitor *m);
 static void centeredmaster(Monitor *m);
 static void vstack (Monitor *m);
 static void bstackhoriz(Monitor *m);
-static Bool evpredicate();
 
 static int screen;
 static int sw, sh; /* X display screen geometry width, height */
@@ -200,10 +427,51 @@ static void (*handler[LASTEvent]) (XEvent *) = {
 	[PropertyNotify] = propertynotify,
 	[UnmapNotify] = unmapnotify
 };
+static void (*timeout[TimerLast]) (void) = {
+	[TimerGeom] = geomtimeout,
+	[TimerKill] = pingtimeout,
+	[TimerHover] = hovertimeout
+};
+static long long timers[TimerLast]; // deadlines in microseconds, 0 if disarmed
+static int rrevbase;
+static int syncevbase, syncerrbase; // 0 without the SYNC extension
+static unsigned int nsyncing; // clients with syncing set
+static PendingKill kills[MAXKILLS]; // queue ordered by deadline
+static unsigned char killhead, nkills;
+static Window hoverwin; // window the pointer entered last, see hovertimeout()
 static Atom wmatom[WMLast], netatom[NetLast];
 static bool running = true;
+static bool restore = false; // started by restart(), pick up dwmstate
+static bool scanning = false; // manage() leaves focus and arrange to scan()
+static SavedClient *restoring; // snapshot of the client manage() is working on
+static SavedClient *saved;
+static Window *savedstack;
+static unsigned int nsaved, savedsel;
+static char *argv0;
 static Display *dpy;
-static Monitor *mons, *selmon;
+static Monitor monitors[MAXMONS]; // only the last one ever goes away
+static unsigned int nmons;
+static Monitor *mons, *selmon; // mons is monitors while there are any
+// monitor edges cut the screen into cells; grid holds the monitor index + 1
+// of each cell, 0 for none, so pointtomon() is two binary searches
+static int edgex[2 * MAXMONS], edgey[2 * MAXMONS];
+static unsigned int nedgex, nedgey;
+static unsigned char grid[2 * MAXMONS][2 * MAXMONS];
+static int ptrx, ptry; // pointer position as of the last crossing event
+static Client *clients;
+static Client *prevsel; // client that lost focus last, for focusprev()
+static Client *urgent, *lasturgent; // oldest and newest urgent client
+static Client clientpool[MAXCLIENTS];
+static Hints hintpool[MAXCLIENTS];
+static Client *freeclients; // released entries of clientpool
+static unsigned int npool; // entries of clientpool handed out so far
+static unsigned int nspilled; // clients living outside clientpool
+static unsigned int ndamped; // ConfigureRequests ignored by damp()
+static Client *dying; // unmanaged clients waiting for flush()
+static Rule *rules; // open addressing on rulehash(), rulemask + 1 slots
+static unsigned int rulemask;
+static char *rulebuf; // the dwm.rules string the entries of rules point into
+static Shared *shared; // NULL if the page couldn't be set up
 static Window root, wmcheckwin;
 
 Layout layouts[] = { centeredmaster, tile, monocle, };
@@ -212,22 +480,68 @@ unsigned char bh = 0;
 unsigned long col_sel = 0x0000FF;
 unsigned long col_norm = 0x000000;
 float mfact = 0.6;
+unsigned char geomdelay = 100; // ms to wait for monitor changes to settle
+unsigned char killtimeout = 5; // seconds a closing client has to answer a ping
+unsigned char hoverdelay = 0; // ms the pointer has to rest on a window to focus it
+unsigned char syncdelay = 50; // ms arrange() waits for clients to draw before revealing them
 static int fifofd;
+// commands travel from readcmds() to runcmds() through a single producer,
+// single consumer ring; cmdfd is an eventfd that wakes up the main loop
+static Command cmdqueue[CMDQUEUE];
+static atomic_uint cmdhead, cmdtail;
+static int cmdfd;
+static volatile sig_atomic_t reloading; // SIGHUP arrived, runcmds() reloads
+static unsigned int ncmds, cmdmaxdepth;
+static long long cmdwait, cmdmaxwait; // time spent queued, in microseconds
+static Spawn spawns[MAXSPAWNS]; // ring, the oldest entry gets replaced
+static unsigned char nextspawn;
+static long long lastspawn;
+// X events wait here by class, so a flood of one kind can't hold up the others
+static QueuedEvent evqueue[ClassLast][EVQUEUE];
+static unsigned int evhead[ClassLast], evtail[ClassLast];
+static const unsigned int evbatch[ClassLast] = { 64, 32, 16 }; // handled per pass of run()
+static const char *classnames[ClassLast] = { "input", "structure", "property" };
+static Latency evwait[ClassLast]; // until the handler ran
+static Latency evlatency[ClassLast]; // until the handler returned
+static long long evqueued; // when the event being handled was taken, 0 outside runevents()
+static Client *evclient; // what the event being handled is about, set by its handler
+static const char *noisenames[NoiseLast] = { "property", "configure", "message", "enter", "focus" };
+// latency from a MapRequest or FIFO read to the flush() that sends the result
+static Latency maplatency, cmdlatency[128]; // the latter by opcode
+static struct { unsigned char op; long long queued; } settling[CMDQUEUE];
+static unsigned int nsettling, nmapping;
 
 float clamp(float x, float l, float h) {
 	return x < l ? l : x > h ? h : x;
 }
 
 unsigned int tile_count(Monitor *m) {
-	unsigned char n = 0;
+	unsigned int n = 0;
 	Client *c;
-	for (c = nexttiled(m->clients); c; c = nexttiled(c->next)) n++;
+	for (c = nexttiled(clients, m); c; c = nexttiled(c->next, m)) n++;
 	return n;
 }
 
+Client *allocclient(void) {
+	Client *c;
+
+	if ((c = freeclients))
+		freeclients = c->next;
+	else if (npool < MAXCLIENTS)
+		c = &clientpool[npool++];
+	else { // rather than leave windows unmanaged, take the hit of a scattered client
+		nspilled++;
+		return ecalloc(1, sizeof(Spilled));
+	}
+	memset(c, 0, sizeof(Client));
+	memset(HINTS(c), 0, sizeof(Hints));
+	return c;
+}
+
 int applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact) {
 	int baseismin;
 	Monitor *m = c->mon;
+	Hints *hints = HINTS(c);
 
 	/* set minimum possible */
 	*w = MAX(1, *w);
@@ -256,61 +570,86 @@ int applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact) {
 	if (*w < bh)
 		*w = bh;
 	if (c->isfloating || !WORKSPACE(c->mon).layout) {
+		if (!hints->valid)
+			updatesizehints(c);
 		/* see last two sentences in ICCCM 4.1.2.3 */
-		baseismin = c->basew == c->minw && c->baseh == c->minh;
+		baseismin = hints->basew == hints->minw && hints->baseh == hints->minh;
 		if (!baseismin) { /* temporarily remove base dimensions */
-			*w -= c->basew;
-			*h -= c->baseh;
+			*w -= hints->basew;
+			*h -= hints->baseh;
 		}
 		/* adjust for aspect limits */
-		if (c->mina > 0 && c->maxa > 0) {
-			if (c->maxa < (float)*w / *h)
-				*w = *h * c->maxa + 0.5;
-			else if (c->mina < (float)*h / *w)
-				*h = *w * c->mina + 0.5;
+		if (hints->mina > 0 && hints->maxa > 0) {
+			if (hints->maxa < (float)*w / *h)
+				*w = *h * hints->maxa + 0.5;
+			else if (hints->mina < (float)*h / *w)
+				*h = *w * hints->mina + 0.5;
 		}
 		if (baseismin) { /* increment calculation requires this */
-			*w -= c->basew;
-			*h -= c->baseh;
+			*w -= hints->basew;
+			*h -= hints->baseh;
 		}
 		/* adjust for increment value */
-		if (c->incw)
-			*w -= *w % c->incw;
-		if (c->inch)
-			*h -= *h % c->inch;
+		if (hints->incw)
+			*w -= *w % hints->incw;
+		if (hints->inch)
+			*h -= *h % hints->inch;
 		/* restore base dimensions */
-		*w = MAX(*w + c->basew, c->minw);
-		*h = MAX(*h + c->baseh, c->minh);
-		if (c->maxw)
-			*w = MIN(*w, c->maxw);
-		if (c->maxh)
-			*h = MIN(*h, c->maxh);
+		*w = MAX(*w + hints->basew, hints->minw);
+		*h = MAX(*h + hints->baseh, hints->minh);
+		if (hints->maxw)
+			*w = MIN(*w, hints->maxw);
+		if (hints->maxh)
+			*h = MIN(*h, hints->maxh);
 	}
 	return *x != c->x || *y != c->y || *w != c->w || *h != c->h;
 }
 
 void arrange(Monitor *m) {
-	if (m) showhide(m->stack);
-	else FOREACH(m, mons) { showhide(m->stack); }
+	Monitor *t;
+	unsigned char i;
+
+	FOREACH(t, mons)
+		if (!m || t == m) {
+			t->fullscreen = fullscreenon(t);
+			for (i = 0; i < WORKSPACES; i++)
+				showhide(t->workspaces[i].stack);
+		}
+	// lay everything out first, so all monitors share one wait in waitsync()
 	if (m) {
 		arrangemon(m);
+		waitsync();
+		reveal(m);
 		restack(m);
-	} else FOREACH(m, mons) { arrangemon(m); }
+	} else {
+		FOREACH(m, mons)
+			arrangemon(m);
+		waitsync();
+		FOREACH(m, mons)
+			reveal(m);
+	}
 }
 
 void arrangemon(Monitor *m) {
-	if (WORKSPACE(m).layout)
+	// tiled clients are out of sight, lay them out once the fullscreen one goes
+	if (WORKSPACE(m).layout && !m->fullscreen)
 		WORKSPACE(m).layout(m);
 }
 
 void attach(Client *c) {
-	c->next = c->mon->clients;
-	c->mon->clients = c;
+	c->prev = NULL;
+	c->next = clients;
+	if (clients)
+		clients->prev = c;
+	clients = c;
 }
 
 void attachstack(Client *c) {
-	c->snext = c->mon->stack;
-	c->mon->stack = c;
+	c->sprev = NULL;
+	c->snext = c->workspace->stack;
+	if (c->workspace->stack)
+		c->workspace->stack->sprev = c;
+	c->workspace->stack = c;
 }
 
 void checkotherwm(void) {
@@ -323,40 +662,49 @@ void checkotherwm(void) {
 }
 
 void cleanup(void) {
-	Monitor *m;
-
 	view(0);
 	WORKSPACE(selmon).layout = NULL;
-	FOREACH(m, mons)
-		while (m->stack)
-			unmanage(m->stack, 0);
-	while (mons)
-		cleanupmon(mons);
+	while (clients)
+		unmanage(clients, 0);
+	flush();
+	while (nmons)
+		cleanupmon(&monitors[nmons - 1]);
 	XDestroyWindow(dpy, wmcheckwin);
 	XSync(dpy, False);
 	XSetInputFocus(dpy, PointerRoot, RevertToPointerRoot, CurrentTime);
 	XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
 	close(fifofd);
 	remove(dwmfifo);
+	free(rules);
+	free(rulebuf);
+	if (shared) {
+		munmap(shared, sizeof(Shared));
+		shm_unlink(dwmshared);
+	}
 }
 
+// mon has to be the last monitor
 void cleanupmon(Monitor *mon) {
-	Monitor *m;
-
-	if (mon == mons)
-		mons = mons->next;
-	else {
-		for (m = mons; m && m->next != mon; m = m->next);
-		m->next = mon->next;
-	}
-	free(mon);
+	if (--nmons)
+		monitors[nmons - 1].next = NULL;
+	else
+		mons = NULL;
 }
 
 void clientmessage(XEvent *e) {
 	XClientMessageEvent *cme = &e->xclient;
-	Client *c = wintoclient(cme->window);
+	Client *c;
+	unsigned char i;
 
-	if (!c)
+	if (cme->window == root && cme->message_type == wmatom[WMProtocols]
+		&& (Atom)cme->data.l[0] == netatom[NetWMPing]) {
+		// the client is alive, let it finish closing on its own terms
+		for (i = 0; i < nkills; i++)
+			if (kills[(killhead + i) % MAXKILLS].win == (Window)cme->data.l[2])
+				kills[(killhead + i) % MAXKILLS].win = None;
+		return;
+	}
+	if (!(evclient = c = wintoclient(cme->window)))
 		return;
 	if (cme->message_type == netatom[NetWMState]) {
 		if (cme->data.l[1] == netatom[NetWMFullscreen] || cme->data.l[2] == netatom[NetWMFullscreen])
@@ -385,25 +733,12 @@ void configure(Client *c) {
 }
 
 void configurenotify(XEvent *e) {
-	Monitor *m;
-	Client *c;
 	XConfigureEvent *ev = &e->xconfigure;
-	int dirty;
 
-	// TODO: updategeom handling sucks, needs to be simplified
 	if (ev->window == root) {
-		dirty = (sw != ev->width || sh != ev->height);
 		sw = ev->width;
 		sh = ev->height;
-		if (updategeom() || dirty) {
-			FOREACH(m, mons) {
-				FOREACH(c, m->clients)
-					if (c->isfullscreen)
-						resizeclient(c, m->mx, m->my, m->mw, m->mh);
-			}
-			focus(NULL);
-			arrange(NULL);
-		}
+		settimer(TimerGeom, geomdelay);
 	}
 }
 
@@ -413,23 +748,25 @@ void configurerequest(XEvent *e) {
 	XConfigureRequestEvent *ev = &e->xconfigurerequest;
 	XWindowChanges wc;
 
-	if ((c = wintoclient(ev->window))) {
+	if ((evclient = c = wintoclient(ev->window))) {
+		if (damp(c, ev))
+			return;
 		if (c->isfloating || !WORKSPACE(selmon).layout) {
 			m = c->mon;
 			if (ev->value_mask & CWX) {
-				c->oldx = c->x;
+				HINTS(c)->oldx = c->x;
 				c->x = m->mx + ev->x;
 			}
 			if (ev->value_mask & CWY) {
-				c->oldy = c->y;
+				HINTS(c)->oldy = c->y;
 				c->y = m->my + ev->y;
 			}
 			if (ev->value_mask & CWWidth) {
-				c->oldw = c->w;
+				HINTS(c)->oldw = c->w;
 				c->w = ev->width;
 			}
 			if (ev->value_mask & CWHeight) {
-				c->oldh = c->h;
+				HINTS(c)->oldh = c->h;
 				c->h = ev->height;
 			}
 				c->x = m->mx + (m->mw / 2 - WIDTH(c) / 2); /* center in x direction */
@@ -454,17 +791,62 @@ void configurerequest(XEvent *e) {
 	XSync(dpy, False);
 }
 
+// appends a monitor, the caller checks there's room
 Monitor *createmon(void) {
-	Monitor *m;
-	m = ecalloc(1, sizeof(Monitor));
-	m->workspace = 0;
+	Monitor *m = &monitors[nmons];
+
+	memset(m, 0, sizeof(Monitor));
 	for (unsigned char i = 0; i < WORKSPACES; i++) {
 		m->workspaces[i].mfact = mfact;
 		m->workspaces[i].layout = layouts[0];
 	}
+	if (nmons++)
+		m[-1].next = m;
+	mons = monitors;
 	return m;
 }
 
+// a client fighting its geometry sends the same request again as soon as it
+// is answered; past DAMPREPEATS identical requests a second they are ignored
+bool damp(Client *c, XConfigureRequestEvent *ev) {
+	Hints *hints = HINTS(c);
+	long long t = now();
+
+	if (ev->value_mask == hints->reqmask && ev->x == hints->reqx && ev->y == hints->reqy
+		&& ev->width == hints->reqw && ev->height == hints->reqh && t - hints->reqtime < 1000000) {
+		hints->reqtime = t;
+		if (++hints->repeats <= DAMPREPEATS)
+			return false;
+		hints->repeats = DAMPREPEATS;
+		hints->damped++;
+		ndamped++;
+		return true;
+	}
+	hints->reqmask = ev->value_mask;
+	hints->reqx = ev->x;
+	hints->reqy = ev->y;
+	hints->reqw = ev->width;
+	hints->reqh = ev->height;
+	hints->reqtime = t;
+	hints->repeats = 0;
+	return false;
+}
+
+// a fresh file at path, never whatever another user left there in /tmp
+FILE *createfile(const char *path) {
+	FILE *f;
+	int fd;
+
+	remove(path);
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600)) < 0)
+		return NULL;
+	if (!(f = fdopen(fd, "w"))) {
+		close(fd);
+		remove(path);
+	}
+	return f;
+}
+
 void cyclelayout(char x) {
 	unsigned char i;
 	for(i = 0; layouts[i] != WORKSPACE(selmon).layout; i++);
@@ -500,58 +882,226 @@ void destroynotify(XEvent *e) {
 }
 
 void detach(Client *c) {
-	Client **tc;
-
-	for (tc = &c->mon->clients; *tc && *tc != c; tc = &(*tc)->next);
-	*tc = c->next;
+	if (c->prev)
+		c->prev->next = c->next;
+	else
+		clients = c->next;
+	if (c->next)
+		c->next->prev = c->prev;
 }
 
 void detachstack(Client *c) {
-	Client **tc, *t;
+	if (c->sprev)
+		c->sprev->snext = c->snext;
+	else
+		c->workspace->stack = c->snext;
+	if (c->snext)
+		c->snext->sprev = c->sprev;
+
+	if (c == c->mon->sel)
+		c->mon->sel = WORKSPACE(c->mon).stack;
+}
+
+// the clients that cost the most time handling their events, noisiest first
+void dumpnoise(void) {
+	FILE *f;
+	Client *c, *top[NOISIEST];
+	XClassHint ch;
+	unsigned int n = 0, i, j;
+	long long total[NOISIEST], t;
+	enum Noise k;
+
+	FOREACH(c, clients) {
+		for (k = 0, t = 0; k < NoiseLast; k++)
+			t += HINTS(c)->noisetime[k];
+		for (i = n; i > 0 && total[i - 1] < t; i--);
+		if (i == NOISIEST)
+			continue;
+		j = MIN(n, NOISIEST - 1);
+		memmove(&top[i + 1], &top[i], (j - i) * sizeof(Client *));
+		memmove(&total[i + 1], &total[i], (j - i) * sizeof(long long));
+		top[i] = c;
+		total[i] = t;
+		n = MIN(n + 1, NOISIEST);
+	}
+	if (!(f = createfile(dwmnoise)))
+		return;
+	for (i = 0; i < n; i++) {
+		c = top[i];
+		ch.res_class = ch.res_name = NULL;
+		XGetClassHint(dpy, c->win, &ch);
+		fprintf(f, "%#lx %s %s %lld", c->win, ch.res_class ? ch.res_class : "-",
+			ch.res_name ? ch.res_name : "-", total[i]);
+		for (k = 0; k < NoiseLast; k++)
+			fprintf(f, " %s %u %lld", noisenames[k], HINTS(c)->noise[k], HINTS(c)->noisetime[k]);
+		fputc('\n', f);
+		if (ch.res_class)
+			XFree(ch.res_class);
+		if (ch.res_name)
+			XFree(ch.res_name);
+	}
+	fclose(f);
+}
 
-	for (tc = &c->mon->stack; *tc && *tc != c; tc = &(*tc)->snext);
-	*tc = c->snext;
+void dumpstats(void) {
+	FILE *f, *statm;
+	DIR *fds;
+	Client *c;
+	enum Class k;
+	unsigned int i, nfree = 0;
+	unsigned long rss;
 
-	if (c == c->mon->sel) {
-		for (t = c->mon->stack; t && !ISVISIBLE(t); t = t->snext);
-		c->mon->sel = t;
+	if (!(f = createfile(dwmstats)))
+		return;
+	fprintf(f, "ipc depth %u %u\n", atomic_load(&cmdtail) - atomic_load(&cmdhead), cmdmaxdepth);
+	fprintf(f, "ipc wait %u %lld %lld\n", ncmds, ncmds ? cmdwait / ncmds : 0, cmdmaxwait);
+	for (k = 0; k < ClassLast; k++) {
+		fprintf(f, "wait %s", classnames[k]);
+		printlatency(f, &evwait[k]);
+		fprintf(f, "event %s", classnames[k]);
+		printlatency(f, &evlatency[k]);
+	}
+	fprintf(f, "map");
+	printlatency(f, &maplatency);
+	for (i = 0; i < LENGTH(cmdlatency); i++)
+		if (cmdlatency[i].n) {
+			fprintf(f, "cmd %c", i);
+			printlatency(f, &cmdlatency[i]);
+		}
+	// resources, for spotting leaks over weeks of uptime
+	if ((statm = fopen("/proc/self/statm", "r"))) {
+		if (fscanf(statm, "%*u %lu", &rss) == 1)
+			fprintf(f, "rss %lu\n", rss * sysconf(_SC_PAGESIZE));
+		fclose(statm);
+	}
+	if ((fds = opendir("/proc/self/fd"))) {
+		for (i = 0; readdir(fds); i++);
+		closedir(fds);
+		fprintf(f, "fds %u\n", i - 3); // less ., .. and the one opendir() holds
 	}
+	for (c = freeclients; c; c = c->next)
+		nfree++;
+	fprintf(f, "clients %u %u %u\n", npool, npool - nfree, nspilled);
+	fprintf(f, "damped %u\n", ndamped);
+	FOREACH(c, clients)
+		if (HINTS(c)->damped)
+			fprintf(f, "damped %#lx %u\n", c->win, HINTS(c)->damped);
+	fclose(f);
 }
 
 Monitor *dirtomon(int dir) { // finds the next or previous monitor
-	Monitor *m = NULL;
-	if (dir > 0) // find next monitor
-		m = selmon->next ? selmon->next : mons;
-	else { // find previous monitor
-		m = mons;
-		if (selmon == mons) // find the very last monitor
-			FIND(m, m->next == NULL)
-		else // find the monitor before the current monitor
-			FIND(m, m->next == selmon)
-	}
-	return m;
+	return &monitors[(selmon - monitors + nmons + (dir > 0 ? 1 : -1)) % nmons];
 }
 
 void enternotify(XEvent *e) {
-	Client *c;
-	Monitor *m;
 	XCrossingEvent *ev = &e->xcrossing;
 
+	ptrx = ev->x_root;
+	ptry = ev->y_root;
 	if ((ev->mode != NotifyNormal || ev->detail == NotifyInferior) && ev->window != root)
 		return;
-	c = wintoclient(ev->window);
-	m = c ? c->mon : wintomon(ev->window);
-	if (m != selmon) {
-		unfocus(selmon->sel, 1);
-		selmon = m;
-	} else if (!c || c == selmon->sel)
+	if (!hoverdelay)
+		hover(ev->window);
+	else { // windows the pointer only passes over never get focus
+		hoverwin = ev->window;
+		settimer(TimerHover, hoverdelay);
+	}
+}
+
+// release the clients unmanaged during the last event batch together, then
+// focus, publish the client list and arrange each affected monitor once
+void flush(void) {
+	Client *c;
+	Monitor *m;
+	XWindowChanges wc;
+	bool withdraw = false;
+	unsigned int i;
+	long long t;
+
+	if (dying) {
+		// a window unmapped and mapped again in one pass is managed anew, leave it be
+		for (c = dying; c && !withdraw; c = c->next)
+			withdraw = !HINTS(c)->destroyed && !wintoclient(c->win);
+		if (withdraw) {
+			wc.border_width = borderpx;
+			XGrabServer(dpy); // avoid race conditions
+			XSetErrorHandler(xerrordummy);
+			for (c = dying; c; c = c->next)
+				if (!HINTS(c)->destroyed && !wintoclient(c->win)) {
+					XConfigureWindow(dpy, c->win, CWBorderWidth, &wc); // restore border
+					setclientstate(c, WithdrawnState);
+				}
+			XSync(dpy, False);
+			XSetErrorHandler(xerror);
+			XUngrabServer(dpy);
+		}
+		while ((c = dying)) {
+			dying = c->next;
+			freeclient(c);
+		}
+		focus(NULL);
+		updateclientlist();
+	}
+	FOREACH(m, mons)
+		if (m->dirty) {
+			m->dirty = 0;
+			arrange(m);
+		}
+	// whatever is left is on its way before the loop blocks again
+	XFlush(dpy);
+	if (!nsettling && !nmapping)
 		return;
-	focus(c);
+	t = now();
+	for (i = 0; i < nsettling; i++)
+		record(&cmdlatency[settling[i].op & 127], t - settling[i].queued);
+	if (nmapping)
+		FOREACH(c, clients)
+			if (HINTS(c)->mapped) {
+				record(&maplatency, t - HINTS(c)->mapped);
+				HINTS(c)->mapped = 0;
+			}
+	nsettling = nmapping = 0;
+}
+
+void record(Latency *l, long long us) {
+	l->n++;
+	l->total += us;
+	l->max = MAX(l->max, us);
+	l->buckets[bucket(us)]++;
+}
+
+// below 4 one bucket per microsecond, then four per power of two
+unsigned int bucket(long long us) {
+	unsigned int o;
+
+	if (us < 4)
+		return us < 0 ? 0 : us;
+	o = 63 - __builtin_clzll(us);
+	return MIN(4 * (o - 1) + (us >> (o - 2) & 3), BUCKETS - 1);
+}
+
+// upper bound of the bucket holding the pct-th percentile
+long long percentile(Latency *l, unsigned int pct) {
+	unsigned int i, o, seen = 0;
+
+	for (i = 0; i < BUCKETS; i++)
+		if ((seen += l->buckets[i]) * 100ULL >= (unsigned long long)l->n * pct)
+			break;
+	if (i < 4)
+		return MIN(i, l->max);
+	o = i / 4 + 1;
+	return MIN(((4LL + i % 4 + 1) << (o - 2)) - 1, l->max);
+}
+
+// n avg max p50 p99
+void printlatency(FILE *f, Latency *l) {
+	fprintf(f, " %u %lld %lld %lld %lld\n", l->n, l->n ? l->total / l->n : 0, l->max,
+		percentile(l, 50), percentile(l, 99));
 }
 
 void focus(Client *c) {
 	if (!c || !ISVISIBLE(c))
-		for (c = selmon->stack; c && !ISVISIBLE(c); c = c->snext);
+		c = WORKSPACE(selmon).stack;
 	if (selmon->sel && selmon->sel != c)
 		unfocus(selmon->sel, 0);
 	if (c) {
@@ -559,6 +1109,8 @@ void focus(Client *c) {
 			selmon = c->mon;
 		detachstack(c);
 		attachstack(c);
+		if (c->needsgeom && WORKSPACE(c->mon).layout == monocle && !c->mon->fullscreen)
+			monocle(c->mon);
 		XSetWindowBorder(dpy, c->win, col_sel);
 		setfocus(c);
 	} else {
@@ -566,13 +1118,40 @@ void focus(Client *c) {
 		XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
 	}
 	selmon->sel = c;
+	if (c && c->isurgent)
+		updatewmhints(c); // clears the hint now that c is selected
 }
 
 // there are some broken focus acquiring clients needing extra handling
+Client *fullscreenon(Monitor *m) {
+	Client *c;
+
+	for (c = WORKSPACE(m).stack; c && !c->isfullscreen; c = c->snext);
+	return c;
+}
+
 void focusin(XEvent *e) {
 	XFocusChangeEvent *ev = &e->xfocus;
-	if (selmon->sel && ev->window != selmon->sel->win)
+	if (selmon->sel && ev->window != selmon->sel->win) {
+		evclient = wintoclient(ev->window); // charge whoever took the focus
 		setfocus(selmon->sel);
+	}
+}
+
+void focusdir(enum Dir dir) {
+	Monitor *m = selmon->adj[dir];
+
+	if (!m)
+		return;
+	unfocus(selmon->sel, 0);
+	selmon = m;
+	focus(NULL);
+}
+
+// jump to the client that has been urgent the longest
+void focusurgent(void) {
+	if (urgent)
+		jumpto(urgent);
 }
 
 void focusmon(char x) {
@@ -586,22 +1165,30 @@ void focusmon(char x) {
 	focus(NULL);
 }
 
+// jump to the client that had focus before the current one, wherever it is
+void focusprev(void) {
+	Client *c = prevsel, *from = selmon->sel;
+
+	if (!c || c == from)
+		return;
+	jumpto(c);
+	prevsel = from; // so that it toggles
+}
+
 void focusstack(char x) {
 	Client *c = NULL, *i;
 
 	if (!selmon->sel || selmon->sel->isfullscreen)
 		return;
 	if (x > 0) {
-		for (c = selmon->sel->next; c && !ISVISIBLE(c); c = c->next);
+		for (c = selmon->sel->next; c && !ISVISIBLEON(c, selmon); c = c->next);
 		if (!c)
-			for (c = selmon->clients; c && !ISVISIBLE(c); c = c->next);
+			for (c = clients; c && !ISVISIBLEON(c, selmon); c = c->next);
 	} else {
-		for (i = selmon->clients; i != selmon->sel; i = i->next)
-			if (ISVISIBLE(i))
-				c = i;
+		for (c = selmon->sel->prev; c && !ISVISIBLEON(c, selmon); c = c->prev);
 		if (!c)
-			for (; i; i = i->next)
-				if (ISVISIBLE(i))
+			for (i = selmon->sel; i; i = i->next)
+				if (ISVISIBLEON(i, selmon))
 					c = i;
 	}
 	if (c) {
@@ -610,6 +1197,28 @@ void focusstack(char x) {
 	}
 }
 
+// monitor changes arrive in bursts, so they are only applied once things settle
+void geomtimeout(void) {
+	Client *c;
+
+	if (!updategeom())
+		return;
+	focus(NULL);
+	FOREACH(c, clients)
+		if (c->mon->dirty && c->isfullscreen)
+			resizeclient(c, c->mon->mx, c->mon->my, c->mon->mw, c->mon->mh);
+}
+
+void freeclient(Client *c) {
+	if (!INPOOL(c)) {
+		nspilled--;
+		free(c);
+		return;
+	}
+	c->next = freeclients;
+	freeclients = c;
+}
+
 Atom getatomprop(Client *c, Atom prop) {
 	int di;
 	unsigned long dl;
@@ -632,6 +1241,54 @@ int getrootptr(int *x, int *y) {
 	return XQueryPointer(dpy, root, &dummy, &dummy, x, y, &di, &di, &dui);
 }
 
+// focus the client or monitor under the pointer
+void hover(Window w) {
+	Client *c = evclient = wintoclient(w);
+	Monitor *m = c ? c->mon : wintomon(w);
+
+	if (m != selmon) {
+		unfocus(selmon->sel, 1);
+		selmon = m;
+	} else if (!c || c == selmon->sel)
+		return;
+	focus(c);
+}
+
+void hovertimeout(void) {
+	hover(hoverwin);
+}
+
+pid_t getwinpid(Window w) {
+	int format;
+	unsigned long n, extra;
+	unsigned char *p = NULL;
+	Atom type;
+	pid_t pid = 0;
+
+	if (XGetWindowProperty(dpy, w, netatom[NetWMPid], 0L, 1L, False, XA_CARDINAL,
+		&type, &format, &n, &extra, &p) == Success && p) {
+		if (n)
+			pid = *(long *)p;
+		XFree(p);
+	}
+	return pid;
+}
+
+int gettextprop(Window w, Atom atom, char *text, unsigned int size) {
+	XTextProperty name;
+
+	text[0] = '\0';
+	if (!XGetTextProperty(dpy, w, &name, atom) || !name.value)
+		return 0;
+	// class and role are plain strings, no need for the text list conversions
+	if (name.nitems) {
+		strncpy(text, (char *)name.value, size - 1);
+		text[size - 1] = '\0';
+	}
+	XFree(name.value); // even when empty
+	return text[0] != '\0';
+}
+
 long getstate(Window w) {
 	int format;
 	long result = -1;
@@ -655,40 +1312,143 @@ static int isuniquegeom(XineramaScreenInfo *unique, size_t n, XineramaScreenInfo
 	return 1;
 }
 
+// select c's monitor and workspace and focus it, arranging at most once
+void jumpto(Client *c) {
+	if (c->mon != selmon) {
+		unfocus(selmon->sel, 0);
+		selmon = c->mon;
+	}
+	if (ISVISIBLE(c)) {
+		focus(c);
+		restack(selmon);
+	} else {
+		selmon->workspace = c->workspace - selmon->workspaces;
+		focus(c);
+		arrange(selmon);
+	}
+}
+
+// ask politely first; a client that doesn't answer the ping is killed after
+// killtimeout, and killing a client that is already closing forces it
 void killclient(void) {
-	if (!selmon->sel)
+	Client *c = selmon->sel;
+	PendingKill *k;
+	unsigned char i;
+
+	if (!c)
 		return;
-	if (!sendevent(selmon->sel, wmatom[WMDelete])) {
-		XGrabServer(dpy);
-		XSetErrorHandler(xerrordummy);
-		XSetCloseDownMode(dpy, DestroyAll);
-		XKillClient(dpy, selmon->sel->win);
-		XSync(dpy, False);
-		XSetErrorHandler(xerror);
-		XUngrabServer(dpy);
+	for (i = 0; i < nkills; i++)
+		if (kills[(killhead + i) % MAXKILLS].win == c->win) {
+			kills[(killhead + i) % MAXKILLS].win = None;
+			XKillClient(dpy, c->win);
+			return;
+		}
+	if (!sendevent(c, wmatom[WMDelete]))
+		XKillClient(dpy, c->win);
+	else if (nkills < MAXKILLS) {
+		k = &kills[(killhead + nkills++) % MAXKILLS];
+		k->win = c->win;
+		k->deadline = now() + killtimeout * 1000000LL;
+		sendevent(c, netatom[NetWMPing]); // a pong lets it take its time
+		if (!timers[TimerKill])
+			timers[TimerKill] = k->deadline;
 	}
 }
 
+void loadstate(void) {
+	FILE *f;
+	Monitor *m;
+	SavedClient *s;
+	struct stat st;
+	unsigned int i, j, nm, ws, lt;
+	float fact;
+	int fd;
+
+	// /tmp is shared, only trust a plain file of our own
+	if ((fd = open(dwmstate, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) < 0)
+		return;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_uid != getuid() || !(f = fdopen(fd, "r"))) {
+		close(fd);
+		return;
+	}
+	remove(dwmstate);
+	// each client takes at least "c 0 0 0 0 0 0 0 0 0\n" and "s 0\n", 24 bytes
+	if (fscanf(f, "dwm %u %u %u", &nm, &nsaved, &savedsel) != 3 || nsaved > st.st_size / 24) {
+		nsaved = 0;
+		goto out;
+	}
+	for (i = 0, m = mons; i < nm; i++, m = m ? m->next : NULL) {
+		if (fscanf(f, " m %u", &ws) != 1)
+			goto out;
+		for (j = 0; j < WORKSPACES; j++) {
+			if (fscanf(f, " %u %f", &lt, &fact) != 2)
+				goto out;
+			if (m && lt < LENGTH(layouts)) {
+				m->workspaces[j].layout = layouts[lt];
+				m->workspaces[j].mfact = clamp(fact, 0.1, 0.9);
+			}
+		}
+		if (m && ws < WORKSPACES)
+			m->workspace = ws;
+	}
+	saved = ecalloc(nsaved, sizeof(SavedClient));
+	savedstack = ecalloc(nsaved, sizeof(Window));
+	for (i = 0; i < nsaved; i++) {
+		s = &saved[i];
+		if (fscanf(f, " c %lu %u %u %d %d %d %d %d %d", &s->win, &s->mon, &s->workspace,
+			&s->isfloating, &s->oldstate, &s->oldx, &s->oldy, &s->oldw, &s->oldh) != 9)
+			break;
+	}
+	for (j = 0; j < i; j++)
+		if (fscanf(f, " s %lu", &savedstack[j]) != 1)
+			break;
+	nsaved = MIN(i, j);
+out:
+	if (!saved)
+		nsaved = 0;
+	fclose(f);
+}
+
 void manage(Window w, XWindowAttributes *wa) {
 	Client *c, *t = NULL;
+	Spawn *s;
+	Rule *r = NULL;
 	Window trans = None;
 	XWindowChanges wc;
 
-	c = ecalloc(1, sizeof(Client));
+	c = allocclient();
 	c->win = w;
+	if ((HINTS(c)->mapped = evqueued))
+		nmapping++;
 	/* geometry */
-	c->x = c->oldx = wa->x;
-	c->y = c->oldy = wa->y;
-	c->w = c->oldw = wa->width;
-	c->h = c->oldh = wa->height;
-
-	if (XGetTransientForHint(dpy, w, &trans) && (t = wintoclient(trans))) {
+	c->x = HINTS(c)->oldx = wa->x;
+	c->y = HINTS(c)->oldy = wa->y;
+	c->w = HINTS(c)->oldw = wa->width;
+	c->h = HINTS(c)->oldh = wa->height;
+
+	if (restoring) {
+		c->mon = restoring->mon < nmons ? &monitors[restoring->mon] : mons;
+		c->workspace = &c->mon->workspaces[restoring->workspace % WORKSPACES];
+	} else if (XGetTransientForHint(dpy, w, &trans) && (t = wintoclient(trans))) {
 		c->mon = t->mon;
 		c->workspace = t->workspace;
 	} else {
-		c->mon = selmon;
+		if ((s = spawnfor(w))) {
+			c->mon = s->mon;
+			c->workspace = &s->mon->workspaces[s->workspace];
+		} else {
+			c->mon = selmon;
+			c->workspace = &WORKSPACE(c->mon);
+		}
 		c->isfloating = 0;
-		c->workspace = &WORKSPACE(c->mon);
+		if ((r = rulefor(w))) {
+			if (r->monitor >= 0 && r->monitor < nmons) {
+				c->mon = &monitors[r->monitor];
+				c->workspace = &WORKSPACE(c->mon);
+			}
+			if (r->workspace >= 0)
+				c->workspace = &c->mon->workspaces[r->workspace];
+		}
 	}
 
 	if (c->x + WIDTH(c) > c->mon->mx + c->mon->mw)
@@ -703,12 +1463,29 @@ void manage(Window w, XWindowAttributes *wa) {
 	XConfigureWindow(dpy, w, CWBorderWidth, &wc);
 	XSetWindowBorder(dpy, w, col_norm);
 	configure(c); /* propagates border_width, if size doesn't change */
+	updateprotocols(c);
 	updatewindowtype(c);
 	updatesizehints(c);
 	updatewmhints(c);
 	XSelectInput(dpy, w, EnterWindowMask|FocusChangeMask|PropertyChangeMask|StructureNotifyMask);
 	if (!c->isfloating)
-		c->isfloating = c->oldstate = trans != None || c->isfixed;
+		c->isfloating = HINTS(c)->oldstate = trans != None || HINTS(c)->isfixed;
+	if (r && r->floating >= 0) {
+		// fullscreen clients float until they leave it, oldstate is what they go back to
+		if (!c->isfullscreen)
+			c->isfloating = r->floating;
+		HINTS(c)->oldstate = r->floating;
+	}
+	if (restoring) {
+		c->isfloating = restoring->isfloating;
+		HINTS(c)->oldstate = restoring->oldstate;
+		if (c->isfullscreen) {
+			HINTS(c)->oldx = restoring->oldx;
+			HINTS(c)->oldy = restoring->oldy;
+			HINTS(c)->oldw = restoring->oldw;
+			HINTS(c)->oldh = restoring->oldh;
+		}
+	}
 	if (c->isfloating)
 		XRaiseWindow(dpy, c->win);
 	attach(c);
@@ -716,10 +1493,17 @@ void manage(Window w, XWindowAttributes *wa) {
 	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32, PropModeAppend,
 		(unsigned char *) &(c->win), 1);
 	XMoveResizeWindow(dpy, c->win, c->x + 2 * sw, c->y, c->w, c->h); /* some windows require this */
+	c->hidden = 1;
 	setclientstate(c, NormalState);
-	if (c->mon == selmon)
-		unfocus(selmon->sel, 0);
-	c->mon->sel = c;
+	if (scanning) {
+		XMapWindow(dpy, c->win);
+		return;
+	}
+	if (ISVISIBLE(c)) {
+		if (c->mon == selmon)
+			unfocus(selmon->sel, 0);
+		c->mon->sel = c;
+	}
 	arrange(c->mon);
 	XMapWindow(dpy, c->win);
 	focus(NULL);
@@ -737,11 +1521,50 @@ void maprequest(XEvent *e) {
 		manage(ev->window, &wa);
 }
 
-Client *nexttiled(Client *c) {
-	for (; c && (c->isfloating || !ISVISIBLE(c)); c = c->next);
+Client *nexttiled(Client *c, Monitor *m) {
+	for (; c && (c->isfloating || !ISVISIBLEON(c, m)); c = c->next);
 	return c;
 }
 
+void pingtimeout(void) {
+	long long t = now();
+	PendingKill *k;
+
+	while (nkills) {
+		k = &kills[killhead];
+		if (k->deadline > t) {
+			timers[TimerKill] = k->deadline;
+			return;
+		}
+		if (k->win && wintoclient(k->win))
+			XKillClient(dpy, k->win);
+		killhead = (killhead + 1) % MAXKILLS;
+		nkills--;
+	}
+}
+
+struct timeval *nexttimer(struct timeval *tv) {
+	long long t, next = 0;
+	unsigned char i;
+
+	for (i = 0; i < TimerLast; i++)
+		if (timers[i] && (!next || timers[i] < next))
+			next = timers[i];
+	if (!next)
+		return NULL;
+	t = MAX(0, next - now());
+	tv->tv_sec = t / 1000000;
+	tv->tv_usec = t % 1000000;
+	return tv;
+}
+
+long long now(void) { // monotonic clock in microseconds
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
 void pop(Client *c) {
 	detach(c);
 	attach(c);
@@ -756,7 +1579,7 @@ void propertynotify(XEvent *e) {
 
 	if (ev->state == PropertyDelete)
 		return; /* ignore */
-	else if ((c = wintoclient(ev->window))) {
+	else if ((evclient = c = wintoclient(ev->window))) {
 		switch(ev->atom) {
 			default: break;
 			case XA_WM_TRANSIENT_FOR:
@@ -766,7 +1589,7 @@ void propertynotify(XEvent *e) {
 					arrange(c->mon);
 				break;
 			case XA_WM_NORMAL_HINTS:
-				updatesizehints(c);
+				HINTS(c)->valid = 0; // reread when they're needed
 				break;
 			case XA_WM_HINTS:
 				updatewmhints(c);
@@ -774,19 +1597,138 @@ void propertynotify(XEvent *e) {
 		}
 		if (ev->atom == netatom[NetWMWindowType])
 			updatewindowtype(c);
+		else if (ev->atom == wmatom[WMProtocols])
+			updateprotocols(c);
 	}
 }
 
-Monitor *recttomon(int x, int y, int w, int h) {
-	Monitor *m, *r = selmon;
-	int a, area = 0;
+unsigned char protomask(Atom proto) {
+	if (proto == wmatom[WMDelete])
+		return ProtoDelete;
+	if (proto == wmatom[WMTakeFocus])
+		return ProtoTakeFocus;
+	if (proto == netatom[NetWMPing])
+		return ProtoPing;
+	if (proto == netatom[NetWMSyncRequest])
+		return ProtoSync;
+	return 0;
+}
 
-	FOREACH(m, mons)
-		if ((a = INTERSECT(x, y, w, h, m)) > area) {
-			area = a;
-			r = m;
+// seqlock writer for the shared page, only touched when something changed
+void publish(void) {
+	SharedMonitor sm[MAXMONS] = {0};
+	SharedMonitor *p;
+	unsigned int n = 0, sel = 0, seq, i;
+	Monitor *m;
+	Client *c;
+
+	if (!shared)
+		return;
+	for (m = mons; m; m = m->next, n++) {
+		p = &sm[n];
+		*p = (SharedMonitor){ m->mx, m->my, m->mw, m->mh, m->wx, m->wy, m->ww, m->wh,
+			m->workspace, 0, WORKSPACE(m).mfact };
+		for (i = 0; i < LENGTH(layouts) && layouts[i] != WORKSPACE(m).layout; i++);
+		p->layout = i;
+		p->sel = m->sel ? m->sel->win : 0;
+		sel = m == selmon ? n : sel;
+	}
+	FOREACH(c, clients) {
+		i = c->mon - monitors;
+		if (c->isfloating)
+			sm[i].floating[c->workspace - c->mon->workspaces]++;
+		else
+			sm[i].tiled[c->workspace - c->mon->workspaces]++;
+		if (c->isurgent)
+			sm[i].urgent[c->workspace - c->mon->workspaces]++;
+	}
+	if (shared->nmons == n && shared->selmon == sel && !memcmp(shared->mons, sm, sizeof sm))
+		return;
+	seq = atomic_load_explicit(&shared->seq, memory_order_relaxed);
+	atomic_store_explicit(&shared->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	shared->nmons = n;
+	shared->selmon = sel;
+	memcpy(shared->mons, sm, sizeof sm);
+	atomic_store_explicit(&shared->seq, seq + 2, memory_order_release);
+}
+
+void pushcmd(Command *cmd) {
+	unsigned int tail = atomic_load_explicit(&cmdtail, memory_order_relaxed);
+	uint64_t one = 1;
+
+	while (tail - atomic_load_explicit(&cmdhead, memory_order_acquire) == CMDQUEUE) {
+		// full, make sure the main loop is draining and give it a moment
+		write(cmdfd, &one, sizeof one);
+		nanosleep(&(struct timespec){ .tv_nsec = 1000000 }, NULL);
+	}
+	cmd->queued = now();
+	cmdqueue[tail % CMDQUEUE] = *cmd;
+	atomic_store_explicit(&cmdtail, tail + 1, memory_order_release);
+}
+
+// runs in its own thread and must not touch Xlib or any dwm state
+void *readcmds(void *unused) {
+	unsigned char buf[64];
+	ssize_t i, n;
+	size_t len = 0;
+	bool inarg = false; // collecting the argument of cmd up to a newline
+	Command cmd;
+	uint64_t one = 1;
+	sigset_t set;
+
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL); // signals are for the main thread
+	for (;;) {
+		if ((n = read(fifofd, buf, sizeof buf)) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("dwm: reading " dwmfifo);
+			return NULL;
+		}
+		for (i = 0; i < n; i++) {
+			if (inarg) {
+				if (buf[i] != '\n') {
+					if (len < sizeof cmd.arg - 1)
+						cmd.arg[len++] = buf[i];
+					continue;
+				}
+				cmd.arg[len] = '\0';
+				inarg = false;
+				pushcmd(&cmd);
+			} else if (buf[i] > ' ') { // skip the newlines echo adds
+				cmd.op = buf[i];
+				cmd.arg[len = 0] = '\0';
+				if (!(inarg = cmd.op == 'x'))
+					pushcmd(&cmd);
+			}
 		}
-	return r;
+		write(cmdfd, &one, sizeof one);
+	}
+}
+
+// the cell of edges the value falls in, n if it's outside all of them
+static unsigned int edgeindex(int *edges, unsigned int n, int v) {
+	unsigned int lo = 0, hi = n, mid;
+
+	if (!n || v < edges[0] || v >= edges[n - 1])
+		return n;
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (edges[mid] <= v)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+Monitor *pointtomon(int x, int y) {
+	unsigned int i = edgeindex(edgex, nedgex, x), j = edgeindex(edgey, nedgey, y);
+
+	if (i == nedgex || j == nedgey || !grid[i][j])
+		return selmon;
+	return &monitors[grid[i][j] - 1];
 }
 
 void resize(Client *c, int x, int y, int w, int h, int interact) {
@@ -796,12 +1738,19 @@ void resize(Client *c, int x, int y, int w, int h, int interact) {
 
 void resizeclient(Client *c, int x, int y, int w, int h) {
 	XWindowChanges wc;
+	Hints *hints = HINTS(c);
 
-	c->oldx = c->x; c->x = wc.x = x;
-	c->oldy = c->y; c->y = wc.y = y;
-	c->oldw = c->w; c->w = wc.width = w;
-	c->oldh = c->h; c->h = wc.height = h;
+	c->needsgeom = 0;
+	hints->oldx = c->x; c->x = wc.x = x;
+	hints->oldy = c->y; c->y = wc.y = y;
+	hints->oldw = c->w; c->w = wc.width = w;
+	hints->oldh = c->h; c->h = wc.height = h;
 	wc.border_width = c->isfullscreen ? 0 : borderpx;
+	if (c->hidden) { // lay it out off screen, reveal() brings it back
+		wc.x = WIDTH(c) * -2;
+		if (ISVISIBLE(c) && (w != hints->oldw || h != hints->oldh))
+			syncrequest(c);
+	}
 	XConfigureWindow(dpy, c->win, CWX|CWY|CWWidth|CWHeight|CWBorderWidth, &wc);
 	configure(c);
 	XSync(dpy, False);
@@ -814,58 +1763,263 @@ void restack(Monitor *m) {
 
 	if (!m->sel)
 		return;
+	if (m->fullscreen && m->fullscreen != m->sel)
+		XRaiseWindow(dpy, m->fullscreen->win);
 	if (m->sel->isfloating || !WORKSPACE(m).layout)
 		XRaiseWindow(dpy, m->sel->win);
-	if (WORKSPACE(m).layout) {
+	if (WORKSPACE(m).layout && !m->fullscreen) {
 		wc.stack_mode = Below;
-		for (c = m->stack; c; c = c->snext)
-			if (!c->isfloating && ISVISIBLE(c)) {
+		for (c = WORKSPACE(m).stack; c; c = c->snext)
+			if (!c->isfloating) {
 				XConfigureWindow(dpy, c->win, CWSibling|CWStackMode, &wc);
 				wc.sibling = c->win;
 			}
 	}
 	XSync(dpy, False);
 	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
+	dropevents(EnterNotify);
+	timers[TimerHover] = 0; // an enter still waiting out hoverdelay goes too
+}
+
+// serialise the session and exec a (possibly new) dwm binary to pick it up
+void restart(void) {
+	if (!savestate()) {
+		fputs("dwm: cannot save state to " dwmstate "\n", stderr);
+		return;
+	}
+	XSync(dpy, False);
+	execvp(argv0, (char *[]){ argv0, "-r", NULL });
+	perror("dwm: restart failed");
+	remove(dwmstate);
+}
+
+// reread Xresources and apply only the settings that changed
+void reload(void) {
+	unsigned char oborderpx = borderpx;
+	unsigned long osel = col_sel, onorm = col_norm;
+	float omfact = mfact;
+	unsigned char i;
+	XWindowChanges wc;
+	Monitor *m;
+	Client *c;
+
+	load_xresources(dpy);
+	FOREACH(m, mons) {
+		m->dirty |= borderpx != oborderpx;
+		if (mfact != omfact)
+			for (i = 0; i < WORKSPACES; i++)
+				if (m->workspaces[i].mfact == omfact) {
+					m->workspaces[i].mfact = mfact;
+					m->dirty |= i == m->workspace;
+				}
+	}
+	wc.border_width = borderpx;
+	FOREACH(c, clients) {
+		if (borderpx != oborderpx && !c->isfullscreen)
+			XConfigureWindow(dpy, c->win, CWBorderWidth, &wc);
+		if (c == c->mon->sel ? col_sel == osel : col_norm == onorm)
+			continue;
+		if (ISVISIBLE(c))
+			XSetWindowBorder(dpy, c->win, c == c->mon->sel ? col_sel : col_norm);
+		else
+			c->staleborder = 1;
+	}
+}
+
+void rrnotify(XEvent *e) {
+	if (e->type - rrevbase == RRScreenChangeNotify)
+		XRRUpdateConfiguration(e);
+	settimer(TimerGeom, geomdelay);
 }
 
 void run(void) {
 	XEvent ev;
+	Intake in;
 	fd_set rfds;
+	struct timeval tv;
+	enum Class k;
+	bool busy;
 	int n;
 	int dpyfd, maxfd;
 	XSync(dpy, False);
 	dpyfd = ConnectionNumber(dpy);
-	maxfd = MAX(dpyfd, fifofd) + 1;
+	maxfd = MAX(dpyfd, cmdfd) + 1;
 	while (running) {
+		flush();
 		FD_ZERO(&rfds);
-		FD_SET(fifofd, &rfds);
+		FD_SET(cmdfd, &rfds);
 		FD_SET(dpyfd, &rfds);
-		n = select(maxfd, &rfds, NULL, NULL, NULL);
-		if (n > 0) {
-			if (FD_ISSET(fifofd, &rfds))
-				dispatchcmd();
-			if (FD_ISSET(dpyfd, &rfds))
-				while (XCheckIfEvent(dpy, &ev, evpredicate, NULL))
-					if (handler[ev.type])
-						handler[ev.type](&ev); // call handler
+		// don't block while events wait in xlib or in our own queues
+		for (k = 0, busy = XQLength(dpy); k < ClassLast && !busy; k++)
+			busy = evhead[k] != evtail[k];
+		n = select(maxfd, &rfds, NULL, NULL, busy ? &(struct timeval){0} : nexttimer(&tv));
+		// user commands first, they are what people wait on
+		if (n > 0 && FD_ISSET(cmdfd, &rfds))
+			runcmds();
+		for (;;) {
+			in.nskipped = 0;
+			if (!XCheckIfEvent(dpy, &ev, evpredicate, (XPointer)&in))
+				break;
+			evqueue[in.class][evtail[in.class]++ % EVQUEUE] = (QueuedEvent){ ev, now() };
+		}
+		// a bounded batch per class, then flush() gets to arrange
+		for (k = 0; k < ClassLast; k++)
+			runevents(k);
+		runtimers();
+		publish();
+	}
+}
+
+void runevents(enum Class k) {
+	QueuedEvent *q;
+	unsigned int n;
+	enum Noise i;
+	long long start, end;
+
+	for (n = 0; n < evbatch[k] && evhead[k] != evtail[k]; n++) {
+		q = &evqueue[k][evhead[k]++ % EVQUEUE];
+		start = now();
+		record(&evwait[k], start - q->queued);
+		evqueued = q->queued;
+		evclient = NULL;
+		if (q->ev.type < LASTEvent) {
+			if (handler[q->ev.type])
+				handler[q->ev.type](&q->ev); // call handler
+		} else if (q->ev.type - rrevbase == RRScreenChangeNotify || q->ev.type - rrevbase == RRNotify)
+			rrnotify(&q->ev);
+		end = now();
+		record(&evlatency[k], end - q->queued);
+		if (evclient && (i = noiseof(q->ev.type)) < NoiseLast) {
+			HINTS(evclient)->noise[i]++;
+			HINTS(evclient)->noisetime[i] += end - start;
+		}
+	}
+	evqueued = 0;
+}
+
+// what runevents() charges an event of the given type as
+enum Noise noiseof(int type) {
+	switch (type) {
+	case PropertyNotify: return NoiseProperty;
+	case ConfigureRequest: return NoiseConfigure;
+	case ClientMessage: return NoiseMessage;
+	case EnterNotify: return NoiseEnter;
+	case FocusIn: return NoiseFocus;
+	default: return NoiseLast;
+	}
+}
+
+void runcmds(void) {
+	unsigned int head, tail;
+	uint64_t n;
+	Command cmd;
+	long long wait;
+
+	read(cmdfd, &n, sizeof n); // before looking at the queue, or wakeups get lost
+	if (reloading) {
+		reloading = 0;
+		reload();
+	}
+	head = atomic_load_explicit(&cmdhead, memory_order_relaxed);
+	tail = atomic_load_explicit(&cmdtail, memory_order_acquire);
+	cmdmaxdepth = MAX(cmdmaxdepth, tail - head);
+	for (; head != tail; head++) {
+		cmd = cmdqueue[head % CMDQUEUE];
+		atomic_store_explicit(&cmdhead, head + 1, memory_order_release);
+		wait = now() - cmd.queued;
+		cmdwait += wait;
+		cmdmaxwait = MAX(cmdmaxwait, wait);
+		ncmds++;
+		dispatchcmd(&cmd);
+		settling[nsettling].op = cmd.op;
+		settling[nsettling++].queued = cmd.queued;
+	}
+}
+
+void runtimers(void) {
+	long long t = now();
+	unsigned char i;
+
+	for (i = 0; i < TimerLast; i++)
+		if (timers[i] && timers[i] <= t) {
+			timers[i] = 0;
+			timeout[i]();
+		}
+}
+
+bool savestate(void) {
+	FILE *f;
+	Monitor *m;
+	Client *c;
+	unsigned int i, j, nc = 0;
+
+	if (!(f = createfile(dwmstate)))
+		return false;
+	FOREACH(c, clients)
+		nc++;
+	fprintf(f, "dwm %u %u %u\n", nmons, nc, (unsigned int)(selmon - monitors));
+	FOREACH(m, mons) {
+		fprintf(f, "m %u", m->workspace);
+		for (i = 0; i < WORKSPACES; i++) {
+			for (j = 0; j < LENGTH(layouts) && layouts[j] != m->workspaces[i].layout; j++);
+			fprintf(f, " %u %f", j, m->workspaces[i].mfact);
 		}
+		fputc('\n', f);
+	}
+	FOREACH(c, clients) {
+		fprintf(f, "c %lu %u %u %d %d %d %d %d %d\n", c->win, (unsigned int)(c->mon - monitors),
+			(unsigned int)(c->workspace - c->mon->workspaces),
+			c->isfloating, HINTS(c)->oldstate, HINTS(c)->oldx, HINTS(c)->oldy, HINTS(c)->oldw, HINTS(c)->oldh);
 	}
+	FOREACH(m, mons)
+		for (i = 0; i < WORKSPACES; i++)
+			for (c = m->workspaces[i].stack; c; c = c->snext)
+				fprintf(f, "s %lu\n", c->win);
+	if (ferror(f) | fclose(f)) {
+		remove(dwmstate);
+		return false;
+	}
+	return true;
 }
 
+// manage all existing windows, then focus and arrange each monitor once
 void scan(void) {
 	unsigned int i, num;
 	Window d1, d2, *wins = NULL;
 	XWindowAttributes wa;
+	Monitor *m;
+	Client *c;
 
+	scanning = true;
+	if (restore)
+		loadstate();
+	// restored windows go first, in reverse so attach() rebuilds the old order
+	for (i = nsaved; i-- > 0;) {
+		restoring = &saved[i];
+		if (XGetWindowAttributes(dpy, saved[i].win, &wa) && !wa.override_redirect
+			&& (wa.map_state == IsViewable || getstate(saved[i].win) == IconicState))
+			manage(saved[i].win, &wa);
+	}
+	restoring = NULL;
+	for (i = nsaved; i-- > 0;)
+		if ((c = wintoclient(savedstack[i]))) {
+			detachstack(c);
+			attachstack(c);
+		}
+	if (nsaved && savedsel < nmons)
+		selmon = &monitors[savedsel];
+	free(saved);
+	free(savedstack);
+	nsaved = 0;
 	if (XQueryTree(dpy, root, &d1, &d2, &wins, &num)) {
 		for (i = 0; i < num; i++) {
-			if (!XGetWindowAttributes(dpy, wins[i], &wa) || wa.override_redirect || XGetTransientForHint(dpy, wins[i], &d1))
+			if (!XGetWindowAttributes(dpy, wins[i], &wa) || wa.override_redirect || XGetTransientForHint(dpy, wins[i], &d1) || wintoclient(wins[i]))
 				continue;
 			if (wa.map_state == IsViewable || getstate(wins[i]) == IconicState)
 				manage(wins[i], &wa);
 		}
 		for (i = 0; i < num; i++) { /* now the transients */
-			if (!XGetWindowAttributes(dpy, wins[i], &wa))
+			if (!XGetWindowAttributes(dpy, wins[i], &wa) || wintoclient(wins[i]))
 				continue;
 			if (XGetTransientForHint(dpy, wins[i], &d1) && (wa.map_state == IsViewable || getstate(wins[i]) == IconicState))
 				manage(wins[i], &wa);
@@ -873,17 +2027,21 @@ void scan(void) {
 		if (wins)
 			XFree(wins);
 	}
+	scanning = false;
+	FOREACH(m, mons) {
+		m->sel = WORKSPACE(m).stack;
+		m->dirty = 1;
+	}
+	focus(NULL);
 }
 
 void sendmon(Client *c, Monitor *m) {
 	if (c->mon == m)
 		return;
 	unfocus(c, 1);
-	detach(c);
 	detachstack(c);
 	c->mon = m;
 	c->workspace = &WORKSPACE(m);
-	attach(c);
 	attachstack(c);
 	focus(NULL);
 	arrange(NULL);
@@ -897,16 +2055,9 @@ void setclientstate(Client *c, long state) {
 }
 
 int sendevent(Client *c, Atom proto) {
-	int n;
-	Atom *protocols;
-	int exists = 0;
+	int exists = (c->protocols & protomask(proto)) != 0;
 	XEvent ev;
 
-	if (XGetWMProtocols(dpy, c->win, &protocols, &n)) {
-		while (!exists && n--)
-			exists = protocols[n] == proto;
-		XFree(protocols);
-	}
 	if (exists) {
 		ev.type = ClientMessage;
 		ev.xclient.window = c->win;
@@ -914,13 +2065,14 @@ int sendevent(Client *c, Atom proto) {
 		ev.xclient.format = 32;
 		ev.xclient.data.l[0] = proto;
 		ev.xclient.data.l[1] = CurrentTime;
+		ev.xclient.data.l[2] = c->win; // for _NET_WM_PING
 		XSendEvent(dpy, c->win, False, NoEventMask, &ev);
 	}
 	return exists;
 }
 
 void setfocus(Client *c) {
-	if (!c->neverfocus) {
+	if (!HINTS(c)->neverfocus) {
 		XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
 		XChangeProperty(dpy, root, netatom[NetActiveWindow],
 			XA_WINDOW, 32, PropModeReplace,
@@ -930,23 +2082,42 @@ void setfocus(Client *c) {
 }
 
 void setfullscreen(Client *c, int fullscreen) {
+	int format;
+	unsigned long n = 0, extra;
+	unsigned char *p = NULL;
+	Atom type;
+
 	if (fullscreen && !c->isfullscreen) {
 		XChangeProperty(dpy, c->win, netatom[NetWMState], XA_ATOM, 32,
 			PropModeReplace, (unsigned char*)&netatom[NetWMFullscreen], 1);
 		c->isfullscreen = 1;
-		c->oldstate = c->isfloating;
+		HINTS(c)->oldstate = c->isfloating;
 		c->isfloating = 1;
+		if (ISVISIBLE(c)) {
+			c->mon->fullscreen = c;
+			c->hidden = 0; // no arrange() follows, so resizeclient() puts it on screen
+		}
+		// tell a compositor to get out of the way, unless the client had a say
+		if (!XGetWindowProperty(dpy, c->win, netatom[NetWMBypassCompositor], 0L, 1L, False,
+			XA_CARDINAL, &type, &format, &n, &extra, &p) && p)
+			XFree(p);
+		if ((HINTS(c)->bypass = !n))
+			XChangeProperty(dpy, c->win, netatom[NetWMBypassCompositor], XA_CARDINAL, 32,
+				PropModeReplace, (unsigned char *)&(long){1}, 1);
 		resizeclient(c, c->mon->mx, c->mon->my, c->mon->mw, c->mon->mh);
 		XRaiseWindow(dpy, c->win);
 	} else if (!fullscreen && c->isfullscreen){
 		XChangeProperty(dpy, c->win, netatom[NetWMState], XA_ATOM, 32,
 			PropModeReplace, (unsigned char*)0, 0);
 		c->isfullscreen = 0;
-		c->isfloating = c->oldstate;
-		c->x = c->oldx;
-		c->y = c->oldy;
-		c->w = c->oldw;
-		c->h = c->oldh;
+		c->isfloating = HINTS(c)->oldstate;
+		if (HINTS(c)->bypass)
+			XDeleteProperty(dpy, c->win, netatom[NetWMBypassCompositor]);
+		HINTS(c)->bypass = 0;
+		c->x = HINTS(c)->oldx;
+		c->y = HINTS(c)->oldy;
+		c->w = HINTS(c)->oldw;
+		c->h = HINTS(c)->oldh;
 		resizeclient(c, c->x, c->y, c->w, c->h);
 		arrange(c->mon);
 	}
@@ -957,15 +2128,111 @@ void setlayout(Layout layout) {
 	if (selmon->sel) arrange(selmon);
 }
 
+// keeps the queue of urgent clients in the order they became urgent
+void seturgent(Client *c, bool urg) {
+	Hints *h = HINTS(c);
+
+	if (c->isurgent == urg)
+		return;
+	if ((c->isurgent = urg)) {
+		h->unext = NULL;
+		h->uprev = lasturgent;
+		*(lasturgent ? &HINTS(lasturgent)->unext : &urgent) = c;
+		lasturgent = c;
+	} else {
+		*(h->uprev ? &HINTS(h->uprev)->unext : &urgent) = h->unext;
+		*(h->unext ? &HINTS(h->unext)->uprev : &lasturgent) = h->uprev;
+	}
+}
+
+// asks a client that supports it to tell when it has drawn at its new size
+void syncrequest(Client *c) {
+	XEvent ev;
+	XSyncAlarmAttributes attr;
+	Hints *h = HINTS(c);
+	unsigned long mask = XSyncCACounter | XSyncCAValueType | XSyncCAValue | XSyncCATestType | XSyncCAEvents;
+
+	if (!syncdelay || !syncevbase || !(c->protocols & ProtoSync) || !h->counter)
+		return;
+	h->syncvalue++;
+	// the server tells us when the counter gets there, see waitsync()
+	attr.trigger.counter = h->counter;
+	attr.trigger.value_type = XSyncAbsolute;
+	XSyncIntsToValue(&attr.trigger.wait_value, h->syncvalue & 0xffffffff, h->syncvalue >> 32);
+	attr.trigger.test_type = XSyncPositiveComparison;
+	attr.events = True;
+	if (h->alarm)
+		XSyncChangeAlarm(dpy, h->alarm, mask, &attr);
+	else
+		h->alarm = XSyncCreateAlarm(dpy, mask, &attr);
+	ev.type = ClientMessage;
+	ev.xclient.window = c->win;
+	ev.xclient.message_type = wmatom[WMProtocols];
+	ev.xclient.format = 32;
+	ev.xclient.data.l[0] = netatom[NetWMSyncRequest];
+	ev.xclient.data.l[1] = CurrentTime;
+	ev.xclient.data.l[2] = HINTS(c)->syncvalue & 0xffffffff;
+	ev.xclient.data.l[3] = HINTS(c)->syncvalue >> 32;
+	ev.xclient.data.l[4] = 0;
+	XSendEvent(dpy, c->win, False, NoEventMask, &ev);
+	nsyncing += !c->syncing;
+	c->syncing = 1;
+}
+
+// gives the clients reveal() is about to show up to syncdelay ms to draw,
+// sleeping on the connection until their alarms have all gone off
+void waitsync(void) {
+	XEvent ev;
+	XSyncAlarmNotifyEvent *an;
+	XSyncValue want;
+	Client *c;
+	fd_set fds;
+	int fd = ConnectionNumber(dpy);
+	long long left, deadline = now() + syncdelay * 1000LL;
+
+	while (nsyncing && (left = deadline - now()) > 0) {
+		// reads whatever arrived, other events stay queued for run()
+		if (!XCheckTypedEvent(dpy, syncevbase + XSyncAlarmNotify, &ev)) {
+			FD_ZERO(&fds);
+			FD_SET(fd, &fds);
+			if (select(fd + 1, &fds, NULL, NULL, &(struct timeval){ left / 1000000, left % 1000000 }) <= 0)
+				break;
+			continue;
+		}
+		an = (XSyncAlarmNotifyEvent *)&ev;
+		FOREACH(c, clients)
+			if (c->syncing && HINTS(c)->alarm == an->alarm) {
+				// not an earlier request the alarm was changed from
+				XSyncIntsToValue(&want, HINTS(c)->syncvalue & 0xffffffff, HINTS(c)->syncvalue >> 32);
+				if (XSyncValueGreaterOrEqual(an->counter_value, want)) {
+					c->syncing = 0;
+					nsyncing--;
+				}
+				break;
+			}
+	}
+	if (nsyncing) // too late, show them as they are
+		FOREACH(c, clients)
+			c->syncing = 0;
+	nsyncing = 0;
+}
+
 void setmfact(float x) {
 	if (!x || !WORKSPACE(selmon).layout) return;
 	WORKSPACE(selmon).mfact = clamp(x + WORKSPACE(selmon).mfact, 0.1, 0.9);
 	arrange(selmon);
 }
 
+void settimer(enum Timer t, unsigned int ms) {
+	timers[t] = now() + ms * 1000LL;
+}
+
 void setup(void) {
 	XSetWindowAttributes wa;
 	Atom utf8string;
+	int di, fd;
+	unsigned int seq;
+	pthread_t reader;
 
 	XrmInitialize();
 	load_xresources(dpy);
@@ -978,6 +2245,7 @@ void setup(void) {
 	sw = DisplayWidth(dpy, screen);
 	sh = DisplayHeight(dpy, screen);
 	root = RootWindow(dpy, screen);
+	getrootptr(&ptrx, &ptry); // crossing events keep it current from here on
 	updategeom();
 	// init atoms
 	utf8string = XInternAtom(dpy, "UTF8_STRING", False);
@@ -985,6 +2253,7 @@ void setup(void) {
 	wmatom[WMDelete] = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
 	wmatom[WMState] = XInternAtom(dpy, "WM_STATE", False);
 	wmatom[WMTakeFocus] = XInternAtom(dpy, "WM_TAKE_FOCUS", False);
+	wmatom[WMWindowRole] = XInternAtom(dpy, "WM_WINDOW_ROLE", False);
 	netatom[NetActiveWindow] = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", False);
 	netatom[NetSupported] = XInternAtom(dpy, "_NET_SUPPORTED", False);
 	netatom[NetWMName] = XInternAtom(dpy, "_NET_WM_NAME", False);
@@ -994,6 +2263,11 @@ void setup(void) {
 	netatom[NetWMWindowType] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", False);
 	netatom[NetWMWindowTypeDialog] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DIALOG", False);
 	netatom[NetClientList] = XInternAtom(dpy, "_NET_CLIENT_LIST", False);
+	netatom[NetWMPing] = XInternAtom(dpy, "_NET_WM_PING", False);
+	netatom[NetWMPid] = XInternAtom(dpy, "_NET_WM_PID", False);
+	netatom[NetWMBypassCompositor] = XInternAtom(dpy, "_NET_WM_BYPASS_COMPOSITOR", False);
+	netatom[NetWMSyncRequest] = XInternAtom(dpy, "_NET_WM_SYNC_REQUEST", False);
+	netatom[NetWMSyncRequestCounter] = XInternAtom(dpy, "_NET_WM_SYNC_REQUEST_COUNTER", False);
 	// supporting window for NetWMCheck
 	wmcheckwin = XCreateSimpleWindow(dpy, root, 0, 0, 1, 1, 0, 0, 0);
 	XChangeProperty(dpy, wmcheckwin, netatom[NetWMCheck], XA_WINDOW, 32,
@@ -1010,12 +2284,46 @@ void setup(void) {
 	wa.event_mask = SubstructureRedirectMask|SubstructureNotifyMask|EnterWindowMask|LeaveWindowMask|StructureNotifyMask|PropertyChangeMask;
 	XChangeWindowAttributes(dpy, root, CWEventMask, &wa);
 	XSelectInput(dpy, root, wa.event_mask);
+	if (XRRQueryExtension(dpy, &rrevbase, &di))
+		XRRSelectInput(dpy, root, RRScreenChangeNotifyMask|RROutputChangeNotifyMask);
+	if (!XSyncQueryExtension(dpy, &syncevbase, &syncerrbase) || !XSyncInitialize(dpy, &di, &di))
+		syncevbase = syncerrbase = 0;
 	focus(NULL);
 
 	mkfifo(dwmfifo, 0700);
-	fifofd = open(dwmfifo, O_RDWR | O_NONBLOCK);
+	fifofd = open(dwmfifo, O_RDWR | O_CLOEXEC);
 	if (fifofd < 0)
 		die("Failed to open() DWM fifo" dwmfifo);
+	if ((cmdfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+		die("eventfd:");
+	if (pthread_create(&reader, NULL, readcmds, NULL) || pthread_detach(reader))
+		die("dwm: cannot start the FIFO reader");
+	signal(SIGHUP, sighup);
+	// bars and pagers read this instead of asking X or the FIFO
+	if ((fd = shm_open(dwmshared, O_RDWR | O_CREAT, 0644)) < 0 || ftruncate(fd, sizeof(Shared))
+		|| (shared = mmap(NULL, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		fprintf(stderr, "dwm: cannot share state through %s: %s\n", dwmshared, strerror(errno));
+		shared = NULL;
+	} else {
+		// odd even if the last dwm died halfway through publish()
+		seq = atomic_load(&shared->seq) | 1;
+		atomic_store(&shared->seq, seq);
+		shared->version = SHAREDVERSION;
+		atomic_store(&shared->seq, seq + 1);
+	}
+	if (fd >= 0)
+		close(fd);
+}
+
+// moves the clients arrange() laid out off screen into place
+void reveal(Monitor *m) {
+	Client *c;
+
+	for (c = WORKSPACE(m).stack; c; c = c->snext)
+		if (c->hidden && (c->isfloating || !m->fullscreen)) {
+			XMoveWindow(dpy, c->win, c->x, c->y);
+			c->hidden = 0;
+		}
 }
 
 void showhide(Client *c) {
@@ -1023,7 +2331,16 @@ void showhide(Client *c) {
 		return;
 	if (ISVISIBLE(c)) {
 		// show clients top down
-		XMoveWindow(dpy, c->win, c->x, c->y);
+		if (c->staleborder) {
+			XSetWindowBorder(dpy, c->win, c == c->mon->sel ? col_sel : col_norm);
+			c->staleborder = 0;
+		}
+		// tiled clients stay where they are under a fullscreen one, and
+		// hidden ones come back in reveal(), once they're laid out
+		if (c->isfloating || (!c->mon->fullscreen && !(c->hidden && WORKSPACE(c->mon).layout))) {
+			XMoveWindow(dpy, c->win, c->x, c->y);
+			c->hidden = 0;
+		}
 		if ((!WORKSPACE(c->mon).layout || c->isfloating) && !c->isfullscreen)
 			resize(c, c->x, c->y, c->w, c->h, 0);
 		showhide(c->snext);
@@ -1031,6 +2348,7 @@ void showhide(Client *c) {
 		// hide clients bottom up
 		showhide(c->snext);
 		XMoveWindow(dpy, c->win, WIDTH(c) * -2, c->y);
+		c->hidden = 1;
 	}
 }
 
@@ -1040,14 +2358,70 @@ void sigchld(int unused) {
 	while (0 < waitpid(-1, NULL, WNOHANG));
 }
 
+// start a program without a shell; the arguments are split on blanks and its
+// windows are placed on the current monitor and workspace, wherever the
+// focus is by the time they map
+void spawn(char *cmd) {
+	extern char **environ;
+	char *argv[64], *p;
+	unsigned char n;
+	pid_t pid;
+
+	for (n = 0; n < LENGTH(argv) - 1 && (argv[n] = strtok_r(n ? NULL : cmd, " \t", &p)); n++);
+	argv[n] = NULL;
+	if (!argv[0])
+		return;
+	if ((errno = posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ))) {
+		fprintf(stderr, "dwm: spawn %s: %s\n", argv[0], strerror(errno));
+		return;
+	}
+	spawns[nextspawn] = (Spawn){ pid, selmon, selmon->workspace, lastspawn = now() };
+	nextspawn = (nextspawn + 1) % MAXSPAWNS;
+}
+
+// the spawn() that started the program owning w, if any
+Spawn *spawnfor(Window w) {
+	pid_t pid;
+	unsigned char i;
+	long long t = now();
+
+	if (!lastspawn || t - lastspawn > SPAWNTIMEOUT * 1000000LL)
+		return NULL; // spare the round trip
+	if (!(pid = getwinpid(w)))
+		return NULL;
+	for (i = 0; i < MAXSPAWNS; i++)
+		if (spawns[i].pid == pid && t - spawns[i].time <= SPAWNTIMEOUT * 1000000LL) {
+			// the monitor may have been unplugged since
+			return spawns[i].mon - monitors < nmons ? &spawns[i] : NULL;
+		}
+	return NULL;
+}
+
+// reload through the FIFO, so the loop handles it like any other command
+// the FIFO and the ring may both be full, so never wait on them from here
+void sighup(int unused) {
+	reloading = 1;
+	write(cmdfd, &(uint64_t){1}, sizeof(uint64_t));
+}
+
 void tag(unsigned char x) {
-	if (selmon->sel) {
-		selmon->sel->workspace = &selmon->workspaces[x];
+	Client *c = selmon->sel;
+
+	if (c) {
+		unfocus(c, 0);
+		detachstack(c);
+		c->workspace = &selmon->workspaces[x];
+		attachstack(c);
 		focus(NULL);
 		arrange(selmon);
 	}
 }
 
+void tagdir(enum Dir dir) {
+	if (selmon->sel && selmon->adj[dir])
+		sendmon(selmon->sel, selmon->adj[dir]);
+}
+
 void tagmon(char x) {
 	if (selmon->sel && mons->next)
 		sendmon(selmon->sel, dirtomon(x));
@@ -1058,7 +2432,9 @@ void togglefloating(void) {
 		return;
 	if (selmon->sel->isfullscreen) // no support for fullscreen windows
 		return;
-	selmon->sel->isfloating = !selmon->sel->isfloating || selmon->sel->isfixed;
+	if (!HINTS(selmon->sel)->valid)
+		updatesizehints(selmon->sel);
+	selmon->sel->isfloating = !selmon->sel->isfloating || HINTS(selmon->sel)->isfixed;
 	if (selmon->sel->isfloating)
 		resize(selmon->sel, selmon->sel->x, selmon->sel->y,
 			selmon->sel->w, selmon->sel->h, 0);
@@ -1067,6 +2443,7 @@ void togglefloating(void) {
 
 void unfocus(Client *c, int setfocus) {
 	if (!c) return;
+	prevsel = c;
 	XSetWindowBorder(dpy, c->win, col_norm);
 	if (setfocus) {
 		XSetInputFocus(dpy, root, RevertToPointerRoot, CurrentTime);
@@ -1074,26 +2451,28 @@ void unfocus(Client *c, int setfocus) {
 	}
 }
 
+// the client is released by flush() together with the rest of the batch
 void unmanage(Client *c, int destroyed) {
-	Monitor *m = c->mon;
-	XWindowChanges wc;
+	unsigned char i;
 
+	for (i = 0; i < nkills; i++)
+		if (kills[(killhead + i) % MAXKILLS].win == c->win)
+			kills[(killhead + i) % MAXKILLS].win = None;
+	if (c == prevsel)
+		prevsel = NULL;
+	seturgent(c, 0);
+	if (HINTS(c)->alarm)
+		XSyncDestroyAlarm(dpy, HINTS(c)->alarm);
+	nsyncing -= c->syncing;
+	c->syncing = 0;
+	if (c == c->mon->fullscreen)
+		c->mon->fullscreen = NULL;
 	detach(c);
 	detachstack(c);
-	if (!destroyed) {
-		wc.border_width = borderpx;
-		XGrabServer(dpy); // avoid race conditions
-		XSetErrorHandler(xerrordummy);
-		XConfigureWindow(dpy, c->win, CWBorderWidth, &wc); // restore border
-		setclientstate(c, WithdrawnState);
-		XSync(dpy, False);
-		XSetErrorHandler(xerror);
-		XUngrabServer(dpy);
-	}
-	free(c);
-	focus(NULL);
-	updateclientlist();
-	arrange(m);
+	HINTS(c)->destroyed = destroyed;
+	c->next = dying;
+	dying = c;
+	c->mon->dirty = 1;
 }
 
 void unmapnotify(XEvent *e) {
@@ -1110,60 +2489,57 @@ void unmapnotify(XEvent *e) {
 
 void updateclientlist(void) {
 	Client *c;
-	Monitor *m;
 
 	XDeleteProperty(dpy, root, netatom[NetClientList]);
-	FOREACH(m, mons)
-		FOREACH(c, m->clients)
-			XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32, PropModeAppend, (unsigned char *) &(c->win), 1);
+	FOREACH(c, clients)
+		XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32, PropModeAppend, (unsigned char *) &(c->win), 1);
 }
 
 int updategeom(void) {
 	int dirty = 0;
+	Monitor *m;
 
 	if (XineramaIsActive(dpy)) {
 		int i, j, n, nn;
 		Client *c;
-		Monitor *m;
 		XineramaScreenInfo *info = XineramaQueryScreens(dpy, &nn);
 		XineramaScreenInfo *unique = NULL;
 
-		for (n = 0, m = mons; m; m = m->next, n++);
+		n = nmons;
 		// only consider unique geometries as separate screens
 		unique = ecalloc(nn, sizeof(XineramaScreenInfo));
 		for (i = 0, j = 0; i < nn; i++)
 			if (isuniquegeom(unique, j, &info[i]))
 				memcpy(&unique[j++], &info[i], sizeof(XineramaScreenInfo));
 		XFree(info);
-		nn = j;
+		if ((nn = j) > MAXMONS) {
+			fprintf(stderr, "dwm: only using the first %d of %d screens\n", MAXMONS, nn);
+			nn = MAXMONS;
+		}
 		if (n <= nn) { // new monitors available
-			for (i = 0; i < (nn - n); i++) {
-				for (m = mons; m && m->next; m = m->next);
-				if (m)
-					m->next = createmon();
-				else
-					mons = createmon();
-			}
+			for (i = 0; i < (nn - n); i++)
+				createmon();
 			for (i = 0, m = mons; i < nn && m; m = m->next, i++)
 				if (i >= n || unique[i].x_org != m->mx || unique[i].y_org != m->my || unique[i].width != m->mw || unique[i].height != m->mh)
 				{
-					dirty = 1;
+					dirty = m->dirty = 1;
 					m->mx = m->wx = unique[i].x_org;
 					m->my = m->wy = unique[i].y_org;
 					m->mw = m->ww = unique[i].width;
 					m->mh = m->wh = unique[i].height;
 				}
 		} else { // less monitors available nn < n
+			dirty = 1; // even without clients, the index still points at them
 			for (i = nn; i < n; i++) {
-				for (m = mons; m && m->next; m = m->next);
-				while ((c = m->clients)) {
-					dirty = 1;
-					m->clients = c->next;
-					detachstack(c);
-					c->mon = mons;
-					attach(c);
-					attachstack(c);
-				}
+				m = &monitors[nmons - 1];
+				FOREACH(c, clients)
+					if (c->mon == m) {
+						mons->dirty = 1;
+						detachstack(c);
+						c->mon = mons;
+						c->workspace = &mons->workspaces[c->workspace - m->workspaces];
+						attachstack(c);
+					}
 				if (m == selmon)
 					selmon = mons;
 				cleanupmon(m);
@@ -1171,60 +2547,157 @@ int updategeom(void) {
 		}
 		free(unique);
 	} else {
-		if (!mons)
-			mons = createmon();
+		if (!nmons)
+			createmon();
 		if (mons->mw != sw || mons->mh != sh) {
-			dirty = 1;
+			dirty = mons->dirty = 1;
 			mons->mw = mons->ww = sw;
 			mons->mh = mons->wh = sh;
 		}
 	}
 	if (dirty) {
+		updateindex();
 		selmon = mons;
 		selmon = wintomon(root);
 	}
 	return dirty;
 }
 
+static void addedge(int *edges, unsigned int *n, int v) {
+	unsigned int i;
+
+	for (i = *n; i > 0 && edges[i - 1] > v; i--);
+	if (i > 0 && edges[i - 1] == v)
+		return;
+	memmove(&edges[i + 1], &edges[i], (*n - i) * sizeof(int));
+	edges[i] = v;
+	(*n)++;
+}
+
+// rebuilds the grid behind pointtomon() and the neighbours of every monitor
+void updateindex(void) {
+	Monitor *m, *o;
+	unsigned int i, j, ax;
+	enum Dir d;
+	int lo[2], hi[2], olo[2], ohi[2], gap, overlap;
+	long long score, best;
+
+	nedgex = nedgey = 0;
+	FOREACH(m, mons) {
+		addedge(edgex, &nedgex, m->mx);
+		addedge(edgex, &nedgex, m->mx + m->mw);
+		addedge(edgey, &nedgey, m->my);
+		addedge(edgey, &nedgey, m->my + m->mh);
+	}
+	memset(grid, 0, sizeof grid);
+	for (i = 0; i + 1 < nedgex; i++)
+		for (j = 0; j + 1 < nedgey; j++)
+			FOREACH(m, mons)
+				if (m->mx <= edgex[i] && edgex[i] < m->mx + m->mw
+					&& m->my <= edgey[j] && edgey[j] < m->my + m->mh) {
+					grid[i][j] = m - monitors + 1;
+					break;
+				}
+	// the neighbour is the closest monitor past the facing edge, preferring
+	// ones that line up with m and then the smallest offset between centres
+	FOREACH(m, mons) {
+		lo[0] = m->mx; hi[0] = m->mx + m->mw;
+		lo[1] = m->my; hi[1] = m->my + m->mh;
+		for (d = 0; d < DirLast; d++) {
+			ax = d == DirUp || d == DirDown;
+			m->adj[d] = NULL;
+			best = LLONG_MAX;
+			FOREACH(o, mons) {
+				olo[0] = o->mx; ohi[0] = o->mx + o->mw;
+				olo[1] = o->my; ohi[1] = o->my + o->mh;
+				if (d == DirLeft || d == DirUp) {
+					if (olo[ax] + ohi[ax] >= lo[ax] + hi[ax])
+						continue;
+					gap = lo[ax] - ohi[ax];
+				} else {
+					if (olo[ax] + ohi[ax] <= lo[ax] + hi[ax])
+						continue;
+					gap = olo[ax] - hi[ax];
+				}
+				overlap = MIN(hi[!ax], ohi[!ax]) - MAX(lo[!ax], olo[!ax]);
+				score = (overlap > 0 ? 0 : 1LL << 40) + ((long long)MAX(gap, 0) << 16)
+					+ abs(olo[!ax] + ohi[!ax] - lo[!ax] - hi[!ax]);
+				if (score < best) {
+					best = score;
+					m->adj[d] = o;
+				}
+			}
+		}
+	}
+}
+
+// cached, so focusing and closing don't need a round trip
+void updateprotocols(Client *c) {
+	int n, format;
+	unsigned long nitems, extra;
+	unsigned char *p = NULL;
+	Atom *protocols, type;
+
+	c->protocols = 0;
+	if (XGetWMProtocols(dpy, c->win, &protocols, &n)) {
+		while (n--)
+			c->protocols |= protomask(protocols[n]);
+		XFree(protocols);
+	}
+	HINTS(c)->counter = None;
+	if (HINTS(c)->alarm) { // watches the old counter
+		XSyncDestroyAlarm(dpy, HINTS(c)->alarm);
+		HINTS(c)->alarm = None;
+	}
+	if (c->protocols & ProtoSync && XGetWindowProperty(dpy, c->win, netatom[NetWMSyncRequestCounter],
+		0L, 1L, False, XA_CARDINAL, &type, &format, &nitems, &extra, &p) == Success && p) {
+		if (nitems)
+			HINTS(c)->counter = *(long *)p;
+		XFree(p);
+	}
+}
+
 void updatesizehints(Client *c) {
 	long msize;
 	XSizeHints size;
+	Hints *hints = HINTS(c);
 
 	if (!XGetWMNormalHints(dpy, c->win, &size, &msize))
 		// size is uninitialized, ensure that size.flags aren't used
 		size.flags = PSize;
 	if (size.flags & PBaseSize) {
-		c->basew = size.base_width;
-		c->baseh = size.base_height;
+		hints->basew = size.base_width;
+		hints->baseh = size.base_height;
 	} else if (size.flags & PMinSize) {
-		c->basew = size.min_width;
-		c->baseh = size.min_height;
+		hints->basew = size.min_width;
+		hints->baseh = size.min_height;
 	} else
-		c->basew = c->baseh = 0;
+		hints->basew = hints->baseh = 0;
 	if (size.flags & PResizeInc) {
-		c->incw = size.width_inc;
-		c->inch = size.height_inc;
+		hints->incw = size.width_inc;
+		hints->inch = size.height_inc;
 	} else
-		c->incw = c->inch = 0;
+		hints->incw = hints->inch = 0;
 	if (size.flags & PMaxSize) {
-		c->maxw = size.max_width;
-		c->maxh = size.max_height;
+		hints->maxw = size.max_width;
+		hints->maxh = size.max_height;
 	} else
-		c->maxw = c->maxh = 0;
+		hints->maxw = hints->maxh = 0;
 	if (size.flags & PMinSize) {
-		c->minw = size.min_width;
-		c->minh = size.min_height;
+		hints->minw = size.min_width;
+		hints->minh = size.min_height;
 	} else if (size.flags & PBaseSize) {
-		c->minw = size.base_width;
-		c->minh = size.base_height;
+		hints->minw = size.base_width;
+		hints->minh = size.base_height;
 	} else
-		c->minw = c->minh = 0;
+		hints->minw = hints->minh = 0;
 	if (size.flags & PAspect) {
-		c->mina = (float)size.min_aspect.y / size.min_aspect.x;
-		c->maxa = (float)size.max_aspect.x / size.max_aspect.y;
+		hints->mina = (float)size.min_aspect.y / size.min_aspect.x;
+		hints->maxa = (float)size.max_aspect.x / size.max_aspect.y;
 	} else
-		c->maxa = c->mina = 0.0;
-	c->isfixed = (c->maxw && c->maxh && c->maxw == c->minw && c->maxh == c->minh);
+		hints->maxa = hints->mina = 0.0;
+	hints->isfixed = (hints->maxw && hints->maxh && hints->maxw == hints->minw && hints->maxh == hints->minh);
+	hints->valid = 1;
 }
 
 void updatewindowtype(Client *c) {
@@ -1245,10 +2718,11 @@ void updatewmhints(Client *c) {
 			wmh->flags &= ~XUrgencyHint;
 			XSetWMHints(dpy, c->win, wmh);
 		}
+		seturgent(c, wmh->flags & XUrgencyHint);
 		if (wmh->flags & InputHint)
-			c->neverfocus = !wmh->input;
+			HINTS(c)->neverfocus = !wmh->input;
 		else
-			c->neverfocus = 0;
+			HINTS(c)->neverfocus = 0;
 		XFree(wmh);
 	}
 }
@@ -1262,23 +2736,18 @@ void view(unsigned char x) {
 
 Client *wintoclient(Window w) {
 	Client *c;
-	Monitor *m;
 
-	FOREACH(m, mons) {
-		FOREACH(c, m->clients) {
-			if (c->win == w)
-				return c;
-		}
-	}
+	FOREACH(c, clients)
+		if (c->win == w)
+			return c;
 	return NULL;
 }
 
 Monitor *wintomon(Window w) {
-	int x, y;
 	Client *c;
 
-	if (w == root && getrootptr(&x, &y))
-		return recttomon(x, y, 1, 1);
+	if (w == root)
+		return pointtomon(ptrx, ptry);
 	else if ((c = wintoclient(w)))
 		return c->mon;
 	else
@@ -1291,7 +2760,10 @@ Monitor *wintomon(Window w) {
 int xerror(Display *dpy, XErrorEvent *ee) {
 	if (ee->error_code == BadWindow
 		|| (ee->request_code == X_SetInputFocus && ee->error_code == BadMatch)
-		|| (ee->request_code == X_ConfigureWindow && ee->error_code == BadMatch))
+		|| (ee->request_code == X_ConfigureWindow && ee->error_code == BadMatch)
+		|| (ee->request_code == X_KillClient && ee->error_code == BadValue)
+		|| (syncerrbase && ee->error_code == syncerrbase + XSyncBadCounter) // counter went with its client
+		|| (syncerrbase && ee->error_code == syncerrbase + XSyncBadAlarm))
 		return 0;
 	fprintf(stderr,
 		"dwm: fatal error: request code=%d, error code=%d\n",
@@ -1300,7 +2772,74 @@ int xerror(Display *dpy, XErrorEvent *ee) {
 }
 
 int xerrordummy(Display *dpy, XErrorEvent *ee) { return 0; }
-Bool evpredicate() { return True; }
+
+enum Class evclass(XEvent *ev) {
+	switch (ev->type) {
+	case MapRequest:
+	case FocusIn:
+	case EnterNotify:
+		return ClassInput;
+	case PropertyNotify:
+		return ClassProperty;
+	default:
+		return ClassStructure;
+	}
+}
+
+// the window an event is about, which isn't xany.window for substructure events
+Window evwindow(XEvent *ev) {
+	switch (ev->type) {
+	case MapRequest: return ev->xmaprequest.window;
+	case ConfigureRequest: return ev->xconfigurerequest.window;
+	case ConfigureNotify: return ev->xconfigure.window;
+	case DestroyNotify: return ev->xdestroywindow.window;
+	case UnmapNotify: return ev->xunmap.window;
+	default: return ev->xany.window;
+	}
+}
+
+// takes any event whose class queue has room; input events only jump ahead
+// of structure events when those are about other windows
+Bool evpredicate(Display *dpy, XEvent *ev, XPointer arg) {
+	Intake *in = (Intake *)arg;
+	enum Class k = evclass(ev);
+	Window w = evwindow(ev);
+	unsigned int i;
+
+	if (k == ClassInput) {
+		if (in->nskipped > LENGTH(in->skipped))
+			k = ClassStructure;
+		for (i = 0; i < in->nskipped && k == ClassInput; i++)
+			if (in->skipped[i] == w)
+				k = ClassStructure;
+		for (i = evhead[ClassStructure]; i != evtail[ClassStructure] && k == ClassInput; i++)
+			if (evwindow(&evqueue[ClassStructure][i % EVQUEUE].ev) == w)
+				k = ClassStructure;
+	}
+	if (evtail[k] - evhead[k] == EVQUEUE) {
+		if (k == ClassStructure && in->nskipped <= LENGTH(in->skipped)) {
+			if (in->nskipped < LENGTH(in->skipped))
+				in->skipped[in->nskipped] = w;
+			in->nskipped++;
+		}
+		return False;
+	}
+	in->class = k;
+	return True;
+}
+
+// drops queued events of the given type, like XCheckMaskEvent() does for xlib
+void dropevents(int type) {
+	enum Class k;
+	unsigned int i, j;
+
+	for (k = 0; k < ClassLast; k++) {
+		for (i = j = evhead[k]; i != evtail[k]; i++)
+			if (evqueue[k][i % EVQUEUE].ev.type != type)
+				evqueue[k][j++ % EVQUEUE] = evqueue[k][i % EVQUEUE];
+		evtail[k] = j;
+	}
+}
 
 // Startup Error handler to check if another window manager is already running.
 int xerrorstart(Display *dpy, XErrorEvent *ee) {
@@ -1313,17 +2852,25 @@ void zoom(void) {
 
 	if (!WORKSPACE(selmon).layout || (selmon->sel && selmon->sel->isfloating))
 		return;
-	if (c == nexttiled(selmon->clients))
-		if (!c || !(c = nexttiled(c->next)))
+	if (c == nexttiled(clients, selmon))
+		if (!c || !(c = nexttiled(c->next, selmon)))
 			return;
 	pop(c);
 }
 
 // layouts
+
+// only the tiled client on top is visible, the others are resized when
+// focus() brings them up
 void monocle(Monitor *m) {
-	Client *c;
-	for (c = nexttiled(m->clients); c; c = nexttiled(c->next))
-		resize(c, m->wx, m->wy, m->ww - borderpx*2, m->wh - borderpx*2, 0);
+	Client *c, *top;
+
+	for (top = WORKSPACE(m).stack; top && top->isfloating; top = top->snext);
+	for (c = nexttiled(clients, m); c; c = nexttiled(c->next, m))
+		if (c == top)
+			resize(c, m->wx, m->wy, m->ww - borderpx*2, m->wh - borderpx*2, 0);
+		else
+			c->needsgeom = 1;
 }
 
 void tile(Monitor *m) { m->mw > m->mh ? vstack(m) : bstackhoriz(m); }
@@ -1336,8 +2883,8 @@ void vstack(Monitor *m) {
 	else if (n > 1) {
 		mw = m->ww * WORKSPACE(m).mfact;
 		h = m->wh/(n-1);
-		resize((c = nexttiled(m->clients)), m->wx, m->wy, mw - 2*borderpx, m->wh - 2*borderpx, 0);
-		while((c = nexttiled(c->next)))
+		resize((c = nexttiled(clients, m)), m->wx, m->wy, mw - 2*borderpx, m->wh - 2*borderpx, 0);
+		while((c = nexttiled(c->next, m)))
 			resize(c, m->wx + mw, m->wy + h*(i++), m->ww - mw - 2*borderpx, h - 2*borderpx, 0);
 	}
 }
@@ -1349,9 +2896,9 @@ void bstackhoriz(Monitor *m) {
 	if (n == 1) monocle(m);
 	else if (n > 1) {
 		mh = WORKSPACE(m).mfact * m->wh;
-		resize((c = nexttiled(m->clients)), m->wx, m->wy, m->ww - 2*borderpx, mh - 2*borderpx, 0);
+		resize((c = nexttiled(clients, m)), m->wx, m->wy, m->ww - 2*borderpx, mh - 2*borderpx, 0);
 		w = m->ww/(n-1);
-		while ((c = nexttiled(c->next)))
+		while ((c = nexttiled(c->next, m)))
 			resize(c, w*(i++), m->wy + mh, w, m->wh - mh - 2*borderpx, 0);
 	}
 }
@@ -1364,7 +2911,7 @@ void centeredmaster(Monitor *m) {
 	if (n == 0) return;
 	// setup master (center) window
 	mw = m->ww*WORKSPACE(m).mfact - 2*borderpx;
-	c = nexttiled(m->clients);
+	c = nexttiled(clients, m);
 	resize(c, (m->ww - mw)/2, m->wy, mw, m->wh - 2*borderpx, 0);
 	if (n == 1) return;
 
@@ -1380,7 +2927,7 @@ void centeredmaster(Monitor *m) {
 		? m->wh - 2*borderpx
 		: m->wh/((n-1)/2) - 2*borderpx;
 	n = ((n-1)/2 + (n-1)%2);
-	for (c = nexttiled(c->next); c; c = nexttiled(c->next)) {
+	for (c = nexttiled(c->next, m); c; c = nexttiled(c->next, m)) {
 		if (n) {
 			resize(c, m->wx + (m->ww + mw)/2 + 2*borderpx, m->wy + right_y, (m->ww - mw)/2 - 2*borderpx, right_h, 0);
 			right_y += right_h + 2*borderpx;
@@ -1393,16 +2940,113 @@ void centeredmaster(Monitor *m) {
 }
 
 void load_xresources(Display *dpy) {
-	char *resm;
+	char *resm = NULL;
+	int format;
+	unsigned long n, extra;
+	Atom type;
 	XrmDatabase db;
-	resm = XResourceManagerString(dpy);
-	if (!resm) return;
+
+	// XResourceManagerString() is only read at connect time, so ask the server
+	if (XGetWindowProperty(dpy, DefaultRootWindow(dpy), XA_RESOURCE_MANAGER, 0L, 0x1000000L, False,
+		XA_STRING, &type, &format, &n, &extra, (unsigned char **)&resm) != Success || !resm)
+		return;
 	db = XrmGetStringDatabase(resm);
+	XFree(resm);
 	resource_load(db, "borderpx", INTEGER, &borderpx);
 	resource_load(db, "bh", INTEGER, &bh);
 	resource_load(db, "col_sel", HEX, &col_sel);
 	resource_load(db, "col_norm", HEX, &col_norm);
 	resource_load(db, "mfact", FLOAT, &mfact);
+	resource_load(db, "geomdelay", INTEGER, &geomdelay);
+	resource_load(db, "killtimeout", INTEGER, &killtimeout);
+	resource_load(db, "hoverdelay", INTEGER, &hoverdelay);
+	resource_load(db, "syncdelay", INTEGER, &syncdelay);
+	compilerules(db);
+	XrmDestroyDatabase(db);
+}
+
+// dwm.rules holds entries separated by ';' or newlines, each made of
+// class instance role workspace monitor floating, where "*" in the first three
+// matches anything and "-" in the others leaves the choice to manage()
+void compilerules(XrmDatabase db) {
+	char *type, *entry, *field[6], *p, *q;
+	XrmValue ret;
+	unsigned int n, i, j;
+	Rule *r;
+
+	free(rules);
+	free(rulebuf);
+	rules = NULL;
+	rulebuf = NULL;
+	if (!XrmGetResource(db, "dwm.rules", "*", &type, &ret) || !ret.addr || strcmp(type, "String"))
+		return;
+	rulebuf = strdup(ret.addr);
+	for (n = 1, p = rulebuf; *p; p++) // upper bound on the entries
+		n += *p == ';' || *p == '\n';
+	for (rulemask = 1; rulemask < 2 * n; rulemask <<= 1);
+	rules = ecalloc(rulemask--, sizeof(Rule));
+	for (entry = strtok_r(rulebuf, ";\n", &p); entry; entry = strtok_r(NULL, ";\n", &p)) {
+		for (i = 0; i < LENGTH(field) && (field[i] = strtok_r(i ? NULL : entry, " \t", &q)); i++);
+		if (i < LENGTH(field)) {
+			if (i)
+				fprintf(stderr, "dwm: ignoring rule for %s, it needs 6 fields\n", field[0]);
+			continue;
+		}
+		// a later rule for the same windows replaces the earlier one
+		for (j = rulehash(field[0], field[1], field[2]) & rulemask; (r = &rules[j])->class; j = (j + 1) & rulemask)
+			if (!strcmp(r->class, field[0]) && !strcmp(r->instance, field[1]) && !strcmp(r->role, field[2]))
+				break;
+		*r = (Rule){ field[0], field[1], field[2],
+			*field[3] == '-' ? -1 : atoi(field[3]) % WORKSPACES,
+			*field[4] == '-' ? -1 : atoi(field[4]),
+			*field[5] == '-' ? -1 : atoi(field[5]) != 0 };
+	}
+}
+
+// FNV-1a over the three strings, with the terminators in
+unsigned int rulehash(const char *class, const char *instance, const char *role) {
+	const char *s[] = { class, instance, role };
+	unsigned int h = 2166136261u, i;
+	const char *p;
+
+	for (i = 0; i < LENGTH(s); i++)
+		for (p = s[i]; ; p++) {
+			h = (h ^ (unsigned char)*p) * 16777619u;
+			if (!*p)
+				break;
+		}
+	return h;
+}
+
+// the most specific rule for w, trying every mix of exact fields and "*"
+Rule *rulefor(Window w) {
+	char role[256];
+	XClassHint ch = { NULL, NULL };
+	const char *key[3], *any = "*";
+	unsigned int i, j;
+	// exact fields first, then fewer of them, class before instance before role
+	static const unsigned char masks[] = { 7, 6, 5, 3, 4, 2, 1, 0 };
+	Rule *r, *match = NULL;
+
+	if (!rules)
+		return NULL;
+	XGetClassHint(dpy, w, &ch);
+	gettextprop(w, wmatom[WMWindowRole], role, sizeof role);
+	for (i = 0; i < LENGTH(masks) && !match; i++) {
+		key[0] = masks[i] & 4 && ch.res_class ? ch.res_class : any;
+		key[1] = masks[i] & 2 && ch.res_name ? ch.res_name : any;
+		key[2] = masks[i] & 1 && role[0] ? role : any;
+		for (j = rulehash(key[0], key[1], key[2]) & rulemask; (r = &rules[j])->class; j = (j + 1) & rulemask)
+			if (!strcmp(r->class, key[0]) && !strcmp(r->instance, key[1]) && !strcmp(r->role, key[2])) {
+				match = r;
+				break;
+			}
+	}
+	if (ch.res_class)
+		XFree(ch.res_class);
+	if (ch.res_name)
+		XFree(ch.res_name);
+	return match;
 }
 
 void resource_load(XrmDatabase db, char *name, enum ResourceType rtype, void *dst) {
@@ -1426,10 +3070,8 @@ void resource_load(XrmDatabase db, char *name, enum ResourceType rtype, void *ds
 	}
 }
 
-void dispatchcmd(void) {
-	unsigned char c;
-	read(fifofd, &c, 1);
-	switch (c) {
+void dispatchcmd(Command *cmd) {
+	switch (cmd->op) {
 		case 'a': view(0); break;
 		case 'b': view(1); break;
 		case 'c': view(2); break;
@@ -1442,6 +3084,8 @@ void dispatchcmd(void) {
 
 		case 'w': focusstack(+1); break;
 		case 'W': focusstack(-1); break;
+		case 'p': focusprev(); break;
+		case 'g': focusurgent(); break;
 
 		case 'l': cyclelayout(+1); break;
 		case 'L': cyclelayout(-1); break;
@@ -1458,11 +3102,26 @@ void dispatchcmd(void) {
 		case 't': tagmon(-1); break;
 		case 'T': tagmon(+1); break;
 
+		// directions as on a numpad, tagging with the shifted digits
+		case '4': focusdir(DirLeft); break;
+		case '6': focusdir(DirRight); break;
+		case '8': focusdir(DirUp); break;
+		case '2': focusdir(DirDown); break;
+		case '$': tagdir(DirLeft); break;
+		case '^': tagdir(DirRight); break;
+		case '*': tagdir(DirUp); break;
+		case '@': tagdir(DirDown); break;
+
 		case 'r': setmfact(+0.1); break;
 		case 'R': setmfact(-0.1); break;
 
 		case 'z': zoom(); break;
 		case 'q': killclient(); break;
+		case 'Q': restart(); break;
+		case 'u': reload(); break;
+		case 'i': dumpstats(); break;
+		case 'n': dumpnoise(); break;
+		case 'x': spawn(cmd->arg); break;
 		case 'f': togglefloating(); break;
 
 		default: break;
@@ -1470,12 +3129,16 @@ void dispatchcmd(void) {
 }
 
 int main(int argc, char *argv[]) {
+	argv0 = argv[0];
 	if (argc == 2 && !strcmp("-v", argv[1]))
 		die("dwm-"VERSION);
+	else if (argc == 2 && !strcmp("-r", argv[1]))
+		restore = true;
 	else if (argc != 1)
-		die("usage: dwm [-v]");
-	else if (!(dpy = XOpenDisplay(NULL)))
+		die("usage: dwm [-v] [-r]");
+	if (!(dpy = XOpenDisplay(NULL)))
 		die("dwm: cannot open display");
+	fcntl(ConnectionNumber(dpy), F_SETFD, FD_CLOEXEC);
 	checkotherwm();
 	setup();
 	scan();
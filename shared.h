@@ -0,0 +1,56 @@
+// the page dwm keeps current in shared memory for bars and other readers
+//
+// map it read-only and copy it out with sharedread():
+//
+//	int fd = shm_open(SHAREDNAME, O_RDONLY, 0);
+//	Shared *page = mmap(NULL, sizeof(Shared), PROT_READ, MAP_SHARED, fd, 0);
+//	Shared s;
+//	if (sharedread(page, &s))
+//		for (i = 0; i < s.nmons; i++)
+//			draw(&s.mons[i], i == s.selmon);
+//
+// dwm only writes the page when something changed, so poll it at whatever
+// rate the bar redraws. A restarted dwm writes to the same page again.
+#include <stdatomic.h>
+#include <string.h>
+
+#define SHAREDNAME "/dwm" // for shm_open(), /dev/shm/dwm on Linux
+#define SHAREDVERSION 2 // bump on any change to Shared or SharedMonitor
+#define SHAREDMONS 16
+#define SHAREDWORKSPACES 4
+
+// a monitor as seen through the shared page
+typedef struct {
+	int mx, my, mw, mh; // screen area
+	int wx, wy, ww, wh; // window area
+	unsigned int workspace; // selected one
+	unsigned int layout; // index into dwm's layouts
+	float mfact;
+	unsigned int tiled[SHAREDWORKSPACES], floating[SHAREDWORKSPACES]; // clients per workspace
+	unsigned int urgent[SHAREDWORKSPACES];
+	unsigned long sel; // focused window, 0 if none
+} SharedMonitor;
+
+// the shared page; dwm makes seq odd while it writes and even again after
+typedef struct {
+	atomic_uint seq;
+	unsigned int version; // SHAREDVERSION
+	unsigned int nmons, selmon;
+	SharedMonitor mons[SHAREDMONS];
+} Shared;
+
+// copies page into s once dwm isn't writing it; 0 if dwm speaks another version
+static inline int sharedread(Shared *page, Shared *s) {
+	unsigned int seq;
+
+	do {
+		while ((seq = atomic_load_explicit(&page->seq, memory_order_acquire)) & 1);
+		s->version = page->version;
+		s->nmons = page->nmons;
+		s->selmon = page->selmon;
+		memcpy(s->mons, page->mons, sizeof(s->mons));
+		atomic_thread_fence(memory_order_acquire);
+	} while (atomic_load_explicit(&page->seq, memory_order_relaxed) != seq);
+	atomic_store_explicit(&s->seq, seq, memory_order_relaxed);
+	return s->version == SHAREDVERSION;
+}
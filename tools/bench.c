@@ -0,0 +1,228 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/Xrandr.h>
+
+#include "bench.h"
+
+static char stats[1 << 16];
+
+void add(Samples *s, long long us) {
+	if (s->n == s->size) {
+		s->size = s->size ? s->size * 2 : 64;
+		if (!(s->v = realloc(s->v, s->size * sizeof(*s->v))))
+			die("realloc:");
+	}
+	s->v[s->n++] = us;
+}
+
+void command(const char *cmd) {
+	static int fd = -1;
+
+	if (fd < 0 && (fd = open(dwmfifo, O_WRONLY | O_NONBLOCK | O_CLOEXEC)) < 0)
+		die("open " dwmfifo ":");
+	if (write(fd, cmd, strlen(cmd)) < 0)
+		die("write " dwmfifo ":");
+}
+
+void die(const char *fmt, ...) {
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (fmt[0] && fmt[strlen(fmt)-1] == ':') {
+		fputc(' ', stderr);
+		perror(NULL);
+	} else {
+		fputc('\n', stderr);
+	}
+	exit(1);
+}
+
+// asks dwm for a fresh dwmstats and copies the line starting with key, less
+// the key, into line; returns 0 when dwm didn't answer or has no such line
+int dwmstat(const char *key, char *line, int len) {
+	struct stat st;
+	FILE *f;
+	char *s;
+	long long deadline = now() + 2000000;
+	off_t size = -1;
+	size_t n, k = strlen(key);
+
+	remove(dwmstats);
+	command("i");
+	// dwm writes the file in one go, so it is whole once it stops growing
+	for (;;) {
+		usleep(20000);
+		if (!stat(dwmstats, &st) && st.st_size && st.st_size == size)
+			break;
+		size = stat(dwmstats, &st) ? -1 : st.st_size;
+		if (now() > deadline)
+			return 0;
+	}
+	if (!(f = fopen(dwmstats, "r")))
+		return 0;
+	n = fread(stats, 1, sizeof(stats) - 1, f);
+	stats[n] = '\0';
+	fclose(f);
+	for (s = stats; s && *s; s = strchr(s, '\n') ? strchr(s, '\n') + 1 : NULL)
+		if (!strncmp(s, key, k) && s[k] == ' ') {
+			snprintf(line, len, "%.*s", (int)strcspn(s + k + 1, "\n"), s + k + 1);
+			return 1;
+		}
+	return 0;
+}
+
+// an unmapped window dwm will manage, reporting its geometry and focus to us
+Window mkwin(Display *dpy, const char *instance) {
+	XClassHint ch = { (char *)instance, "DwmBench" };
+	Window w = XCreateSimpleWindow(dpy, DefaultRootWindow(dpy), 0, 0, 100, 100, 0, 0, 0);
+
+	XSelectInput(dpy, w, StructureNotifyMask | FocusChangeMask);
+	XSetClassHint(dpy, w, &ch);
+	XStoreName(dpy, w, instance);
+	return w;
+}
+
+long long now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int cmpll(const void *a, const void *b) {
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+long long percentile(Samples *s, unsigned int p) {
+	if (!s->n)
+		return -1;
+	qsort(s->v, s->n, sizeof(*s->v), cmpll);
+	return s->v[(s->n - 1) * p / 100];
+}
+
+static void effect(XEvent *ev, long long t, void *arg) {
+	static Atom active;
+	Effect *e = arg;
+
+	if (!active)
+		active = XInternAtom(ev->xany.display, "_NET_ACTIVE_WINDOW", False);
+	if (ev->type == ConfigureNotify)
+		e->configure = t;
+	else if (ev->type == FocusIn && e->focus < 0)
+		e->focus = t;
+	else if (ev->type == PropertyNotify && ev->xproperty.atom == active)
+		e->active = t;
+	else
+		return;
+	if (t > e->total)
+		e->total = t;
+}
+
+// writes cmd to dwm and waits until the server has been quiet for quiet us
+void probe(Display *dpy, const char *cmd, long long quiet, Effect *e) {
+	static int watching;
+	long long t;
+
+	if (!watching) {
+		XSelectInput(dpy, DefaultRootWindow(dpy), PropertyChangeMask);
+		watching = 1;
+	}
+	settle(dpy, 0, 0, NULL, NULL); // nothing stale gets charged to cmd
+	*e = (Effect){ -1, -1, -1, -1 };
+	t = now();
+	command(cmd);
+	settle(dpy, quiet, 5000000, effect, e);
+	e->configure -= e->configure < 0 ? 0 : t;
+	e->focus -= e->focus < 0 ? 0 : t;
+	e->active -= e->active < 0 ? 0 : t;
+	e->total -= e->total < 0 ? 0 : t;
+}
+
+// splits the screen into n side by side RandR monitors, the first of which
+// takes over the output, so dwm sees exactly n through Xinerama
+void setmonitors(Display *dpy, int n) {
+	Window root = DefaultRootWindow(dpy);
+	XRRMonitorInfo *mons, *m;
+	XRRScreenResources *res;
+	char name[16];
+	char *s;
+	int i, nmons, w = DisplayWidth(dpy, DefaultScreen(dpy)), h = DisplayHeight(dpy, DefaultScreen(dpy));
+
+	if ((mons = XRRGetMonitors(dpy, root, False, &nmons))) {
+		for (i = 0; i < nmons; i++)
+			if ((s = XGetAtomName(dpy, mons[i].name))) {
+				if (!strncmp(s, "bench", 5))
+					XRRDeleteMonitor(dpy, root, mons[i].name);
+				XFree(s);
+			}
+		XRRFreeMonitors(mons);
+	}
+	if (n < 2 || !(res = XRRGetScreenResourcesCurrent(dpy, root)))
+		goto done;
+	for (i = 0; i < n; i++) {
+		if (!(m = XRRAllocateMonitor(dpy, !i && res->noutput)))
+			die("XRRAllocateMonitor failed");
+		snprintf(name, sizeof(name), "bench%d", i);
+		m->name = XInternAtom(dpy, name, False);
+		m->x = i * (w / n);
+		m->y = 0;
+		m->width = i == n - 1 ? w - m->x : w / n;
+		m->height = h;
+		m->mwidth = DisplayWidthMM(dpy, DefaultScreen(dpy)) * m->width / w;
+		m->mheight = DisplayHeightMM(dpy, DefaultScreen(dpy));
+		if (m->noutput)
+			m->outputs[0] = res->outputs[0];
+		XRRSetMonitor(dpy, root, m);
+		XRRFreeMonitors(m);
+	}
+	XRRFreeScreenResources(res);
+done:
+	XSync(dpy, False);
+}
+
+// hands every event to seen until none came for quiet us, or timeout us
+// passed; with quiet 0 it just drains what is already there
+void settle(Display *dpy, long long quiet, long long timeout, void (*seen)(XEvent *, long long, void *), void *arg) {
+	XEvent ev;
+	fd_set fds;
+	struct timeval tv;
+	long long t, start = now(), last = start, wait;
+	int fd = ConnectionNumber(dpy);
+
+	for (;;) {
+		XFlush(dpy);
+		while (XPending(dpy)) {
+			XNextEvent(dpy, &ev);
+			last = now();
+			if (seen)
+				seen(&ev, last, arg);
+		}
+		t = now();
+		wait = last + quiet - t;
+		if (start + timeout - t < wait)
+			wait = start + timeout - t;
+		if (wait <= 0)
+			return;
+		FD_ZERO(&fds);
+		FD_SET(fd, &fds);
+		tv.tv_sec = wait / 1000000;
+		tv.tv_usec = wait % 1000000;
+		if (select(fd + 1, &fds, NULL, NULL, &tv) < 0 && errno != EINTR)
+			die("select:");
+	}
+}
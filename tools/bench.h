@@ -0,0 +1,33 @@
+// helpers shared by the X clients in tools/ that measure a running dwm from
+// the outside: they own windows, drive dwm through its FIFO and time what the
+// server delivers back
+#include <X11/Xlib.h>
+
+#define LENGTH(X) (sizeof X / sizeof X[0])
+
+#define dwmfifo "/tmp/dwm.fifo"
+#define dwmstats "/tmp/dwm.stats"
+
+typedef struct {
+	long long *v;
+	unsigned int n, size;
+} Samples;
+
+// what a command caused, in microseconds after it was written, or -1 for never
+typedef struct {
+	long long configure; // last ConfigureNotify on any of our windows
+	long long focus;     // first FocusIn on one of them
+	long long active;    // last change of _NET_ACTIVE_WINDOW on the root
+	long long total;     // the latest of the three
+} Effect;
+
+void add(Samples *s, long long us);
+void command(const char *cmd);
+void die(const char *fmt, ...);
+int dwmstat(const char *key, char *line, int len);
+Window mkwin(Display *dpy, const char *instance);
+long long now(void);
+long long percentile(Samples *s, unsigned int p);
+void probe(Display *dpy, const char *cmd, long long quiet, Effect *e);
+void setmonitors(Display *dpy, int n);
+void settle(Display *dpy, long long quiet, long long timeout, void (*seen)(XEvent *, long long, void *), void *arg);
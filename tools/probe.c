@@ -0,0 +1,83 @@
+// maps a few windows on a running dwm, then sends it a script of FIFO
+// commands over and over, timing from the client side when the resulting
+// ConfigureNotify, FocusIn and _NET_ACTIVE_WINDOW change arrive; prints
+// p50/p99 per command and kind of effect as key=value lines, in microseconds,
+// and with -g exits non-zero when any command's p99 is over that many
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <X11/Xlib.h>
+
+#include "bench.h"
+
+enum { Total, Configure, Focus, Active, KindLast };
+
+static const char *kinds[KindLast] = { "total", "configure", "focus", "active" };
+static Samples samples[128][KindLast]; // by opcode
+
+int main(int argc, char *argv[]) {
+	Display *dpy;
+	Effect e;
+	Samples *s;
+	char cmd[2] = {0}, instance[32];
+	const char *script = "abcdBwWzlp";
+	unsigned int i, k, nwins = 8, rounds = 50, fail = 0;
+	long long p99, quiet = 100000, gate = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "g:n:q:r:")) != -1) {
+		switch (opt) {
+		case 'g': gate = strtoll(optarg, NULL, 10); break;
+		case 'n': nwins = strtoul(optarg, NULL, 10); break;
+		case 'q': quiet = strtoll(optarg, NULL, 10) * 1000; break;
+		case 'r': rounds = strtoul(optarg, NULL, 10); break;
+		default: goto usage;
+		}
+	}
+	if (optind < argc - 1) {
+usage:
+		die("usage: probe [-g p99 limit us] [-n windows] [-q quiet ms] [-r rounds] [script]");
+	}
+	if (optind < argc)
+		script = argv[optind];
+	for (i = 0; script[i]; i++)
+		if (strchr("iqQux", script[i]) || script[i] & 128)
+			die("probe: '%c' has no effect to time or takes windows down", script[i]);
+	if (!(dpy = XOpenDisplay(NULL)))
+		die("probe: cannot open display");
+
+	for (i = 0; i < nwins; i++) {
+		snprintf(instance, sizeof(instance), "probe%u", i);
+		XMapWindow(dpy, mkwin(dpy, instance));
+	}
+	settle(dpy, 300000, 10000000, NULL, NULL);
+
+	for (i = 0; i < rounds * strlen(script); i++) {
+		cmd[0] = script[i % strlen(script)];
+		probe(dpy, cmd, quiet, &e);
+		s = samples[(unsigned char)cmd[0]];
+		if (e.total >= 0)
+			add(&s[Total], e.total);
+		if (e.configure >= 0)
+			add(&s[Configure], e.configure);
+		if (e.focus >= 0)
+			add(&s[Focus], e.focus);
+		if (e.active >= 0)
+			add(&s[Active], e.active);
+	}
+
+	for (i = 0; i < LENGTH(samples); i++)
+		for (k = 0; k < KindLast; k++) {
+			if (!(s = &samples[i][k])->n)
+				continue;
+			p99 = percentile(s, 99);
+			printf("cmd=%c kind=%s n=%u p50=%lld p99=%lld\n", i, kinds[k], s->n, percentile(s, 50), p99);
+			if (gate && k == Total && p99 > gate) {
+				fprintf(stderr, "probe: '%c' p99 %lld us is over %lld\n", i, p99, gate);
+				fail = 1;
+			}
+		}
+	XCloseDisplay(dpy);
+	return fail;
+}
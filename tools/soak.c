@@ -0,0 +1,158 @@
+// churns a running dwm at random for a while: maps, unmaps and destroys
+// windows, tags, views, reloads changing rules and plugs monitors in and out.
+// Every interval it samples dwm's RSS and fd count and the p99 of view latency over that
+// interval, and exits non-zero if the last sample grew past the first
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+
+#include "bench.h"
+
+#define MAXWINS 64
+#define P99SLACK 5000 // us of p99 growth that is just Xvfb jitter
+
+typedef struct {
+	long long t, rss, p99;
+	unsigned int fds, n;
+} Sample;
+
+static void resources(Display *dpy);
+static int sample(Display *dpy, long long start, Samples *latency, Sample *s);
+
+static struct { Window win; int mapped; } wins[MAXWINS];
+static unsigned int nwins;
+
+// sets a RESOURCE_MANAGER for the next reload, with a different set of rules,
+// one of them for our own windows, each time
+void resources(Display *dpy) {
+	char buf[4096];
+	int i, n, len;
+
+	len = snprintf(buf, sizeof(buf), "dwm.borderpx: %d\ndwm.mfact: 0.%d\ndwm.rules: DwmBench soak * %c %c %c",
+		1 + rand() % 4, 3 + rand() % 5, "0123-"[rand() % 5], "01-"[rand() % 3], "01-"[rand() % 3]);
+	for (i = 0, n = rand() % 32; i < n; i++)
+		len += snprintf(buf + len, sizeof(buf) - len, ";Soak%d soak%d * %d - -", rand() % 64, i, rand() % 4);
+	len += snprintf(buf + len, sizeof(buf) - len, "\n");
+	XChangeProperty(dpy, DefaultRootWindow(dpy), XA_RESOURCE_MANAGER, XA_STRING, 8,
+		PropModeReplace, (unsigned char *)buf, len);
+	XFlush(dpy);
+}
+
+int sample(Display *dpy, long long start, Samples *latency, Sample *s) {
+	char line[64];
+
+	settle(dpy, 100000, 1000000, NULL, NULL);
+	if (!dwmstat("rss", line, sizeof(line)) || sscanf(line, "%lld", &s->rss) != 1
+	|| !dwmstat("fds", line, sizeof(line)) || sscanf(line, "%u", &s->fds) != 1)
+		return 0;
+	s->t = (now() - start) / 1000000;
+	s->n = latency->n;
+	s->p99 = percentile(latency, 99);
+	latency->n = 0;
+	printf("t=%lld rss=%lld fds=%u p99=%lld n=%u windows=%u\n", s->t, s->rss, s->fds, s->p99, s->n, nwins);
+	fflush(stdout);
+	return 1;
+}
+
+int main(int argc, char *argv[]) {
+	Display *dpy;
+	Samples latency = {0};
+	Sample first = { .t = -1 }, last = {0};
+	Effect e;
+	char cmd[2] = {0};
+	const char *misc = "wWzlLmMtTpg";
+	unsigned int i, a, r, seed = time(NULL), fail = 0;
+	long long start, next, end, duration = 3600, interval = 60, rsstol = 10, p99tol = 2;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:i:p:r:s:")) != -1) {
+		switch (opt) {
+		case 'd': duration = strtoll(optarg, NULL, 10); break;
+		case 'i': interval = strtoll(optarg, NULL, 10); break;
+		case 'p': p99tol = strtoll(optarg, NULL, 10); break;
+		case 'r': rsstol = strtoll(optarg, NULL, 10); break;
+		case 's': seed = strtoul(optarg, NULL, 10); break;
+		default: die("usage: soak [-d seconds] [-i interval seconds] [-r rss growth %%] [-p p99 growth factor] [-s seed]");
+		}
+	}
+	if (interval <= 0 || duration < 2 * interval)
+		die("soak: the duration must cover at least two intervals");
+	if (!(dpy = XOpenDisplay(NULL)))
+		die("soak: cannot open display");
+	srand(seed);
+	printf("seed=%u duration=%lld interval=%lld\n", seed, duration, interval);
+	setmonitors(dpy, 2);
+	// Xvfb starts without resources, and dwm returns early from a reload then
+	resources(dpy);
+	command("u");
+
+	start = now();
+	end = start + duration * 1000000;
+	next = start + interval * 1000000;
+	for (i = 0; now() < end; i++) {
+		r = rand() % MAXWINS;
+		a = rand() % 100;
+		if (a < 25) { // map, an unmapped window again half of the time
+			if (!wins[r].win) {
+				wins[r].win = mkwin(dpy, "soak");
+				nwins++;
+			}
+			if (!wins[r].mapped)
+				XMapWindow(dpy, wins[r].win);
+			wins[r].mapped = 1;
+		} else if (a < 40) {
+			if (wins[r].mapped)
+				XUnmapWindow(dpy, wins[r].win);
+			wins[r].mapped = 0;
+		} else if (a < 50) {
+			if (wins[r].win) {
+				XDestroyWindow(dpy, wins[r].win);
+				nwins--;
+			}
+			wins[r].win = wins[r].mapped = 0;
+		} else if (a < 97) {
+			cmd[0] = a < 65 ? 'A' + rand() % 4 : a < 80 ? 'a' + rand() % 4 : misc[rand() % strlen(misc)];
+			command(cmd);
+		} else if (a < 99) {
+			resources(dpy);
+			command("u");
+		} else {
+			setmonitors(dpy, 1 + rand() % 3);
+		}
+		// pace the churn so the FIFO never fills, and now and then time a view
+		settle(dpy, 2000, 20000, NULL, NULL);
+		if (i % 16 == 15) {
+			cmd[0] = 'a' + rand() % 4;
+			probe(dpy, cmd, 50000, &e);
+			if (e.total >= 0)
+				add(&latency, e.total);
+		}
+		if (now() < next)
+			continue;
+		next += interval * 1000000;
+		if (!sample(dpy, start, &latency, &last))
+			die("soak: dwm stopped answering after %lld s", (now() - start) / 1000000);
+		if (first.t < 0)
+			first = last;
+	}
+
+	// the first sample has the pools and rings warm, anything past it is growth
+	if (last.rss > first.rss + first.rss * rsstol / 100) {
+		fprintf(stderr, "soak: rss grew from %lld to %lld\n", first.rss, last.rss);
+		fail = 1;
+	}
+	if (last.fds > first.fds) {
+		fprintf(stderr, "soak: fds grew from %u to %u\n", first.fds, last.fds);
+		fail = 1;
+	}
+	if (first.n && last.n && last.p99 > first.p99 * p99tol && last.p99 - first.p99 > P99SLACK) {
+		fprintf(stderr, "soak: p99 grew from %lld to %lld us\n", first.p99, last.p99);
+		fail = 1;
+	}
+	XCloseDisplay(dpy);
+	return fail;
+}
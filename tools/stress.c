@@ -0,0 +1,138 @@
+// maps a number of windows across every workspace of every monitor of a
+// running dwm, then times view, tag, focusstack and cyclelayout from the FIFO
+// at that load; prints one key=value line per metric, times in microseconds
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+#include "bench.h"
+
+#define WORKSPACES 4
+
+static void mapnotify(XEvent *ev, long long t, void *arg);
+static void report(const char *metric, Samples *s);
+static void reportdwm(const char *metric, const char *key);
+
+static long long *mapped, *requested;
+static XContext ctx;
+static unsigned int nclients, nmons;
+
+void mapnotify(XEvent *ev, long long t, void *arg) {
+	XPointer i;
+
+	if (ev->type == MapNotify && !XFindContext(ev->xany.display, ev->xmap.window, ctx, &i))
+		if (!mapped[(uintptr_t)i - 1])
+			mapped[(uintptr_t)i - 1] = t;
+}
+
+void report(const char *metric, Samples *s) {
+	printf("clients=%u monitors=%u metric=%s n=%u p50=%lld p99=%lld max=%lld\n",
+		nclients, nmons, metric, s->n, percentile(s, 50), percentile(s, 99), percentile(s, 100));
+}
+
+// the same numbers as dwm has them, up to the flush() after its work
+void reportdwm(const char *metric, const char *key) {
+	char line[256];
+	unsigned int n;
+	long long avg, max, p50, p99;
+
+	if (dwmstat(key, line, sizeof(line)) && sscanf(line, "%u %lld %lld %lld %lld", &n, &avg, &max, &p50, &p99) == 5)
+		printf("clients=%u monitors=%u metric=dwm-%s n=%u p50=%lld p99=%lld max=%lld\n",
+			nclients, nmons, metric, n, p50, p99, max);
+}
+
+int main(int argc, char *argv[]) {
+	Display *dpy;
+	Window *wins;
+	Samples map = {0}, view = {0}, tag = {0}, focusstack = {0}, layout = {0};
+	Effect e;
+	char cmd[2] = {0}, instance[32], line[64];
+	unsigned int i, m, ws, batch, unmapped = 0, spilled, rounds = 20;
+	long long quiet = 100000;
+	int opt;
+
+	nmons = 2;
+	while ((opt = getopt(argc, argv, "m:q:r:")) != -1) {
+		switch (opt) {
+		case 'm': nmons = strtoul(optarg, NULL, 10); break;
+		case 'q': quiet = strtoll(optarg, NULL, 10) * 1000; break;
+		case 'r': rounds = strtoul(optarg, NULL, 10); break;
+		default: goto usage;
+		}
+	}
+	if (optind != argc - 1 || !(nclients = strtoul(argv[optind], NULL, 10)) || !nmons) {
+usage:
+		die("usage: stress [-m monitors] [-q quiet ms] [-r rounds] clients");
+	}
+	if (!(dpy = XOpenDisplay(NULL)))
+		die("stress: cannot open display");
+	if (!(wins = calloc(nclients, sizeof(*wins))) || !(mapped = calloc(nclients, sizeof(*mapped)))
+	|| !(requested = calloc(nclients, sizeof(*requested))))
+		die("calloc:");
+	ctx = XUniqueContext();
+	setmonitors(dpy, nmons);
+	settle(dpy, 500000, 5000000, NULL, NULL); // dwm waits out geomdelay first
+
+	// an even share on each workspace, the selected one of each monitor last
+	for (i = m = 0; m < nmons; m++) {
+		for (ws = 0; ws < WORKSPACES; ws++) {
+			cmd[0] = 'a' + (ws + 1) % WORKSPACES;
+			command(cmd);
+			settle(dpy, quiet, 5000000, NULL, NULL);
+			batch = nclients / (nmons * WORKSPACES) + (m * WORKSPACES + ws < nclients % (nmons * WORKSPACES));
+			for (; batch; batch--, i++) {
+				snprintf(instance, sizeof(instance), "stress%u", i);
+				wins[i] = mkwin(dpy, instance);
+				XSaveContext(dpy, wins[i], ctx, (XPointer)(uintptr_t)(i + 1));
+				requested[i] = now();
+				XMapWindow(dpy, wins[i]);
+				XFlush(dpy);
+			}
+			settle(dpy, 300000, 60000000, mapnotify, NULL);
+		}
+		command("m");
+	}
+	for (i = 0; i < nclients; i++) {
+		if (mapped[i])
+			add(&map, mapped[i] - requested[i]);
+		else
+			unmapped++;
+	}
+
+	for (i = 0; i < rounds; i++) {
+		cmd[0] = 'a' + i % WORKSPACES;
+		probe(dpy, cmd, quiet, &e);
+		if (e.total >= 0)
+			add(&view, e.total);
+		cmd[0] = 'A' + (i + 1) % WORKSPACES;
+		probe(dpy, cmd, quiet, &e);
+		if (e.total >= 0)
+			add(&tag, e.total);
+		probe(dpy, "w", quiet, &e);
+		if (e.total >= 0)
+			add(&focusstack, e.total);
+		probe(dpy, "l", quiet, &e); // every tiled client on the monitor moves
+		if (e.total >= 0)
+			add(&layout, e.total);
+	}
+
+	report("map", &map);
+	report("view", &view);
+	report("tag", &tag);
+	report("focusstack", &focusstack);
+	report("layout", &layout);
+	reportdwm("map", "map");
+	reportdwm("view", "cmd a");
+	reportdwm("tag", "cmd B");
+	reportdwm("focusstack", "cmd w");
+	reportdwm("layout", "cmd l");
+	if (dwmstat("clients", line, sizeof(line)) && sscanf(line, "%*u %*u %u", &spilled) == 1)
+		printf("clients=%u monitors=%u metric=spilled n=%u\n", nclients, nmons, spilled);
+	printf("clients=%u monitors=%u metric=unmapped n=%u\n", nclients, nmons, unmapped);
+	XCloseDisplay(dpy);
+	return unmapped ? 1 : 0;
+}
@@ -0,0 +1,33 @@
+#!/bin/sh
+# runs a command against a fresh bin/dwm on its own Xvfb and exits with its status
+# usage: tools/withdwm.sh command [args...]
+display=${XVFBDISPLAY:-:99}
+screen=${XVFBSCREEN:-2560x1440x24}
+
+# dwm's FIFO and stats have fixed paths, so never start next to a live session
+if [ -e /tmp/dwm.fifo ]; then
+	echo "withdwm: /tmp/dwm.fifo exists, is another dwm running?" >&2
+	exit 1
+fi
+
+Xvfb "$display" -screen 0 "$screen" -nolisten tcp >/dev/null 2>&1 &
+xvfb=$!
+trap 'kill $dwm $xvfb 2>/dev/null; wait; rm -f /tmp/dwm.fifo' EXIT
+trap 'exit 130' INT TERM
+for i in 1 2 3 4 5 6 7 8 9 10; do
+	[ -e "/tmp/.X11-unix/X${display#:}" ] && break
+	sleep 0.5
+done
+
+DISPLAY=$display ./bin/dwm &
+dwm=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+	[ -p /tmp/dwm.fifo ] && break
+	sleep 0.5
+done
+if ! [ -p /tmp/dwm.fifo ]; then
+	echo "withdwm: dwm did not start" >&2
+	exit 1
+fi
+
+DISPLAY=$display "$@"